@@ -0,0 +1,585 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "harness.h"
+#include "queue.h"
+#include "strcmp_simd.h"
+
+/*
+ * External sort, for queues too large to sort in memory.
+ *
+ * The strings are removed from the head of the queue a load at a time,
+ * each load holding what fits in a quarter of the memory budget, with
+ * another quarter indexing its strings.  A load is sorted and written out
+ * as a run, a sorted sequence of records, to a temporary file.  The
+ * elements are freed as their strings are removed, so the queue shrinks
+ * while the runs grow.
+ *
+ * Every run keeps a file descriptor open, so runs are merged as they come:
+ * as soon as the last runs made hold as many of the same level as a merge
+ * takes, they are merged into one of the next level, like the carries of a
+ * counter.  Runs are also merged once as many are open as half the
+ * descriptors the process may have.  Few runs are thus open at any time,
+ * however large the queue.  These merges read through the other half of
+ * the budget.
+ *
+ * The runs left are then merged back into the queue by a loser tree, as
+ * many at a time as the budget gives read buffers of EXTERNAL_BLOCK_MIN
+ * bytes for.  Should there be more runs, groups of them are first merged
+ * into longer runs, pass after pass, until a single merge is left.
+ *
+ * A record is the length of the string followed by its bytes.  Runs are
+ * written through a buffer, and read through a buffer of their own with
+ * pread, which takes no descriptor besides the one of the run.  The files
+ * are unlinked as soon as created, so none is left behind whatever happens.
+ *
+ * The budget bounds the load, its index and the read buffers.  Besides it
+ * come the write buffer, of EXTERNAL_BLOCK bytes, and the current string of
+ * each run being merged.
+ */
+
+/* Smallest buffer a run is read through */
+#define EXTERNAL_BLOCK_MIN 4096
+
+/* Buffer runs are written through */
+#define EXTERNAL_BLOCK 65536
+
+/* Smallest space the current string of a run is read into */
+#define RECORD_MIN 256
+
+/* Failed attempts in a row at merging the runs back into the queue */
+#define EXTERNAL_RETRIES 8
+
+/* Smallest budget, enough for two read buffers */
+#define EXTERNAL_BUDGET_MIN (2 * EXTERNAL_BLOCK_MIN)
+
+typedef struct {
+    int fd;    /* Temporary file holding the run */
+    int level; /* Merges its strings went through, for merging as they come */
+    off_t pos; /* Start of the first record not merged back into the queue */
+    /* State of a read, from pos on, through buf */
+    char *buf;
+    size_t size, len, at; /* Size of buf, bytes read into it, bytes used */
+    off_t end;            /* Offset of the file the bytes of buf end at */
+    char *str; /* Current string of the run, NULL once it is exhausted */
+    size_t cap;
+} run_t;
+
+/* Buffered writes of a run to its file */
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+} writer_t;
+
+/* Order of strings a and b for sorting, see q_sort_nocase */
+static inline int compare(const char *a, const char *b)
+{
+    return q_sort_nocase ? str_casecmp(a, b) : str_cmp(a, b);
+}
+
+static int compare_ptr(const void *a, const void *b)
+{
+    return compare(*(char *const *) a, *(char *const *) b);
+}
+
+/* Create an unlinked temporary file in dir, return its descriptor or -1 */
+static int temp_file(const char *dir)
+{
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s/qsortXXXXXX", dir) >=
+        (int) sizeof(path))
+        return -1;
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    return fd;
+}
+
+/*
+ * Most runs to keep open, each holding a descriptor: half of those the
+ * process may have, leaving the others to the rest of the program
+ */
+static int max_open_runs()
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY ||
+        rl.rlim_cur / 2 > INT_MAX)
+        return INT_MAX;
+    return rl.rlim_cur / 2;
+}
+
+/* Write out the bytes buffered by w.  Return false if could not */
+static bool writer_flush(writer_t *w)
+{
+    for (size_t done = 0; done < w->len;) {
+        ssize_t n = write(w->fd, w->buf + done, w->len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    w->len = 0;
+    return true;
+}
+
+static bool write_bytes(writer_t *w, const void *p, size_t n)
+{
+    const char *s = p;
+    while (n > 0) {
+        if (w->len == EXTERNAL_BLOCK && !writer_flush(w))
+            return false;
+        size_t room = EXTERNAL_BLOCK - w->len;
+        size_t chunk = n < room ? n : room;
+        memcpy(w->buf + w->len, s, chunk);
+        w->len += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+    return true;
+}
+
+static bool write_record(writer_t *w, const char *s)
+{
+    size_t len = strlen(s);
+    return write_bytes(w, &len, sizeof(len)) && write_bytes(w, s, len);
+}
+
+/* Start reading run r from the first record not merged back, through buf */
+static void run_open(run_t *r, char *buf, size_t size)
+{
+    r->buf = buf;
+    r->size = size;
+    r->len = r->at = 0;
+    r->end = r->pos;
+    r->str = NULL;
+    r->cap = 0;
+}
+
+static void run_close(run_t *r)
+{
+    free(r->str);
+    r->str = NULL;
+    r->buf = NULL;
+}
+
+/* Offset of the record of r to be read next */
+static inline off_t run_offset(const run_t *r)
+{
+    return r->end - (off_t) (r->len - r->at);
+}
+
+/*
+ * Copy the next n bytes of run r to dst.  Return the number copied, fewer
+ * than n only at the end of the file, or -1 if could not read it.
+ */
+static ssize_t read_bytes(run_t *r, void *dst, size_t n)
+{
+    char *d = dst;
+    size_t done = 0;
+    while (done < n) {
+        if (r->at == r->len) {
+            ssize_t got = pread(r->fd, r->buf, r->size, r->end);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0)
+                return -1;
+            if (got == 0)
+                break;
+            r->len = got;
+            r->at = 0;
+            r->end += got;
+        }
+        size_t chunk = r->len - r->at < n - done ? r->len - r->at : n - done;
+        memcpy(d + done, r->buf + r->at, chunk);
+        r->at += chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+/*
+ * Read the next string of run r into r->str, growing it as needed.
+ * Return false if could not allocate space or read the run.  At the end of
+ * the run, set r->str to NULL.
+ */
+static bool read_record(run_t *r)
+{
+    size_t len;
+    ssize_t got = read_bytes(r, &len, sizeof(len));
+    if (got == 0) {
+        free(r->str);
+        r->str = NULL;
+        return true;
+    }
+    if (got != sizeof(len))
+        return false;
+    if (len + 1 > r->cap) {
+        size_t cap = len + 1 > RECORD_MIN ? len + 1 : RECORD_MIN;
+        char *str = malloc(cap);
+        if (str == NULL)
+            return false;
+        free(r->str);
+        r->str = str;
+        r->cap = cap;
+    }
+    if (read_bytes(r, r->str, len) != (ssize_t) len)
+        return false;
+    r->str[len] = '\0';
+    return true;
+}
+
+/* Does run a come before run b?  Exhausted runs come last, -1 first */
+static inline bool run_first(run_t *runs, int a, int b)
+{
+    if (a < 0 || b < 0)
+        return a < 0;
+    if (runs[a].str == NULL || runs[b].str == NULL)
+        return runs[b].str == NULL;
+    return compare(runs[a].str, runs[b].str) <= 0;
+}
+
+/*
+ * Replay the matches of leaf s from the bottom of loser tree tree, which
+ * has k leaves, leaving the overall winner in tree[0]
+ */
+static void loser_adjust(int *tree, run_t *runs, int k, int s)
+{
+    for (int t = (s + k) / 2; t > 0; t /= 2) {
+        if (run_first(runs, tree[t], s)) {
+            int winner = tree[t];
+            tree[t] = s;
+            s = winner;
+        }
+    }
+    tree[0] = s;
+}
+
+/*
+ * Merge the k runs of runs, each read from its first record not merged
+ * back through a buffer of block bytes, calling emit on each string in
+ * order.  If consume, the strings emitted are merged back for good, and a
+ * later merge starts after them.  Otherwise the runs are left as they were,
+ * to be merged again should this merge fail.
+ * Return false if could not allocate space, read a run, or some emit failed.
+ */
+static bool merge_runs(run_t *runs,
+                       int k,
+                       size_t block,
+                       bool consume,
+                       bool (*emit)(void *, const char *),
+                       void *arg)
+{
+    int *tree = malloc(k * sizeof(int));
+    char *space = malloc(k * block);
+    bool ok = tree != NULL && space != NULL;
+    for (int i = 0; i < k; i++) {
+        run_open(&runs[i], space + i * block, block);
+        ok = ok && read_record(&runs[i]);
+    }
+
+    if (ok) {
+        /* Leaf -1 wins every match, which fills the tree from the bottom */
+        for (int i = 0; i < k; i++)
+            tree[i] = -1;
+        for (int i = k - 1; i >= 0; i--)
+            loser_adjust(tree, runs, k, i);
+    }
+    while (ok && runs[tree[0]].str != NULL) {
+        int w = tree[0];
+        ok = emit(arg, runs[w].str);
+        if (ok && consume)
+            runs[w].pos = run_offset(&runs[w]);
+        ok = ok && read_record(&runs[w]);
+        loser_adjust(tree, runs, k, w);
+    }
+
+    for (int i = 0; i < k; i++)
+        run_close(&runs[i]);
+    free(space);
+    free(tree);
+    return ok;
+}
+
+/*
+ * Read each of the n runs of runs back in turn, unsorted, calling emit on
+ * each string.  Needs a single read buffer, for when the runs cannot all
+ * be merged.  Return false if could not read a run or some emit failed;
+ * the strings emitted are not read again.
+ */
+static bool drain_runs(run_t *runs,
+                       int n,
+                       bool (*emit)(void *, const char *),
+                       void *arg)
+{
+    char buf[EXTERNAL_BLOCK_MIN];
+    bool ok = true;
+    for (int i = 0; ok && i < n; i++) {
+        run_t *r = &runs[i];
+        run_open(r, buf, sizeof(buf));
+        ok = read_record(r);
+        while (ok && r->str != NULL) {
+            ok = emit(arg, r->str);
+            if (ok)
+                r->pos = run_offset(r);
+            ok = ok && read_record(r);
+        }
+        run_close(r);
+    }
+    return ok;
+}
+
+static bool emit_file(void *w, const char *s)
+{
+    return write_record(w, s);
+}
+
+/* Where the runs go back to, with the strings they gave so far */
+typedef struct {
+    queue_t *q;
+    size_t done;
+} rebuild_t;
+
+static bool emit_queue(void *arg, const char *s)
+{
+    rebuild_t *r = arg;
+    if (!q_insert_tail(r->q, (char *) s))
+        return false;
+    r->done++;
+    return true;
+}
+
+/*
+ * Write a new run to a file of dir, from the n strings of strs or, if strs
+ * is NULL, by merging the k runs of from through buffers of block bytes.
+ * Return the descriptor of the file, or -1 if could not create or write it.
+ */
+static int write_run(const char *dir,
+                     char **strs,
+                     size_t n,
+                     run_t *from,
+                     int k,
+                     size_t block)
+{
+    int fd = temp_file(dir);
+    if (fd < 0)
+        return -1;
+    writer_t w = {fd, malloc(EXTERNAL_BLOCK), 0};
+    bool ok = w.buf != NULL;
+    if (ok && strs != NULL)
+        for (size_t i = 0; ok && i < n; i++)
+            ok = write_record(&w, strs[i]);
+    else if (ok)
+        ok = merge_runs(from, k, block, false, emit_file, &w);
+    ok = ok && writer_flush(&w);
+    free(w.buf);
+    if (!ok) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Merge the k runs at the end of runs, of which there are *nruns, into one
+ * through buffers of block bytes.  Return false if could not, leaving them.
+ */
+static bool merge_tail(const char *dir,
+                       run_t *runs,
+                       int *nruns,
+                       int k,
+                       size_t block)
+{
+    run_t *from = runs + *nruns - k;
+    int fd = write_run(dir, NULL, 0, from, k, block);
+    if (fd < 0)
+        return false;
+    /* The oldest run is of the highest level */
+    int level = from[0].level + 1;
+    for (int i = 0; i < k; i++)
+        close(from[i].fd);
+    from[0] = (run_t){.fd = fd, .level = level};
+    *nruns -= k - 1;
+    return true;
+}
+
+/*
+ * Remove the strings of q a load at a time, and write each load sorted as
+ * a run to a file of dir, appending the runs to *runs.  The runs are merged
+ * as they come, fanin at a time through buffers of block bytes, so that no
+ * more than max_open are kept open.
+ * Return false if could not allocate space or write a run.  The strings of
+ * a load that could not be written go back to the tail of q.
+ */
+static bool make_runs(queue_t *q,
+                      const char *dir,
+                      size_t budget,
+                      int fanin,
+                      size_t block,
+                      int max_open,
+                      run_t **runs,
+                      int *nruns)
+{
+    size_t load = budget / 4;
+    size_t max = budget / 4 / (sizeof(size_t) + sizeof(char *));
+    char *buf = malloc(load);
+    size_t *offsets = malloc(max * sizeof(size_t));
+    char **strs = malloc(max * sizeof(char *));
+    bool ok = buf != NULL && offsets != NULL && strs != NULL;
+    int cap = 0;
+
+    while (ok && q_size(q) > 0) {
+        if (*nruns == cap) {
+            int ncap = cap ? 2 * cap : 16;
+            run_t *grown = malloc(ncap * sizeof(run_t));
+            if (grown == NULL) {
+                ok = false;
+                break;
+            }
+            if (*nruns > 0)
+                memcpy(grown, *runs, *nruns * sizeof(run_t));
+            free(*runs);
+            *runs = grown;
+            cap = ncap;
+        }
+
+        /* A string too long for the load buffer is a run of its own */
+        size_t len = strlen(q_peek_head(q));
+        char *big = NULL;
+        size_t n = 1;
+        if (len + 1 > load) {
+            big = malloc(len + 1);
+            if (big == NULL) {
+                ok = false;
+                break;
+            }
+            q_remove_head(q, big, len + 1);
+            strs[0] = big;
+        } else {
+            n = q_remove_head_bulk(q, max, buf, load, offsets);
+            for (size_t i = 0; i < n; i++)
+                strs[i] = buf + offsets[i];
+            qsort(strs, n, sizeof(char *), compare_ptr);
+        }
+
+        int fd = write_run(dir, strs, n, NULL, 0, 0);
+        if (fd >= 0) {
+            (*runs)[(*nruns)++] = (run_t){.fd = fd};
+        } else {
+            for (size_t i = 0; i < n; i++)
+                q_insert_tail(q, strs[i]);
+            ok = false;
+        }
+        free(big);
+
+        /* The last fanin runs, if of a level, or too many open runs */
+        while (ok && *nruns >= fanin &&
+               ((*runs)[*nruns - fanin].level == (*runs)[*nruns - 1].level ||
+                *nruns >= max_open))
+            ok = merge_tail(dir, *runs, nruns, fanin, block);
+    }
+
+    free(buf);
+    free(offsets);
+    free(strs);
+    return ok;
+}
+
+/*
+ * Sort elements of queue q in ascending order, like q_sort, using about
+ * mem_budget bytes of memory besides the queue, the write buffer and the
+ * current strings of the runs, and temporary files in directory tmpdir for
+ * the rest.
+ */
+bool q_sort_external(queue_t *q, const char *tmpdir, size_t mem_budget)
+{
+    if (q == NULL || tmpdir == NULL)
+        return false;
+    if (q_size(q) < 2)
+        return true;
+    if (mem_budget < EXTERNAL_BUDGET_MIN)
+        mem_budget = EXTERNAL_BUDGET_MIN;
+
+    /* Merges while making runs get the half of the budget the load leaves */
+    int max_open = max_open_runs();
+    if (max_open < 2)
+        max_open = 2;
+    int fanin = mem_budget / 2 / EXTERNAL_BLOCK_MIN;
+    if (fanin < 2)
+        fanin = 2;
+    if (fanin > max_open)
+        fanin = max_open;
+    /* Smaller than EXTERNAL_BLOCK_MIN for the smallest budget only */
+    size_t block = mem_budget / 2 / fanin;
+    run_t *runs = NULL;
+    int nruns = 0;
+    bool ok = make_runs(q, tmpdir, mem_budget, fanin, block, max_open, &runs,
+                        &nruns);
+
+    /*
+     * Merge groups of runs into longer ones until they all fit a merge.  A
+     * group that fails to merge is kept as it is, and passes go on as long
+     * as they shorten the list of runs.
+     */
+    fanin = mem_budget / EXTERNAL_BLOCK_MIN;
+    if (fanin > max_open)
+        fanin = max_open;
+    block = mem_budget / fanin;
+    while (nruns > fanin) {
+        int merged = 0;
+        for (int i = 0; i < nruns; i += fanin) {
+            int k = nruns - i < fanin ? nruns - i : fanin;
+            int fd = k > 1 ? write_run(tmpdir, NULL, 0, runs + i, k, block)
+                           : -1;
+            if (fd < 0) {
+                memmove(runs + merged, runs + i, k * sizeof(run_t));
+                merged += k;
+                continue;
+            }
+            for (int j = i; j < i + k; j++)
+                close(runs[j].fd);
+            runs[merged++] = (run_t){.fd = fd};
+        }
+        if (merged == nruns)
+            break;
+        nruns = merged;
+    }
+
+    /*
+     * Rebuild the queue from the runs, after any string left in it.  A
+     * failed merge is tried again from the strings it did not insert, until
+     * EXTERNAL_RETRIES attempts in a row get no further.  Should merging
+     * keep failing, the runs are read back one after the other instead,
+     * unsorted, which takes a single read buffer, the same way.
+     */
+    if (nruns > 0) {
+        block = mem_budget / nruns;
+        if (block < EXTERNAL_BLOCK_MIN)
+            block = EXTERNAL_BLOCK_MIN; /* Only after a failure */
+        rebuild_t rebuild = {q, 0};
+        bool merged = false;
+        for (int stalls = 0; !merged && stalls < EXTERNAL_RETRIES;) {
+            size_t done = rebuild.done;
+            merged =
+                merge_runs(runs, nruns, block, true, emit_queue, &rebuild);
+            stalls = rebuild.done > done ? 0 : stalls + 1;
+        }
+        if (!merged)
+            ok = false;
+        for (int stalls = 0; !merged && stalls < EXTERNAL_RETRIES;) {
+            size_t done = rebuild.done;
+            merged = drain_runs(runs, nruns, emit_queue, &rebuild);
+            stalls = rebuild.done > done ? 0 : stalls + 1;
+        }
+    }
+    for (int i = 0; i < nruns; i++)
+        close(runs[i].fd);
+    free(runs);
+    return ok;
+}
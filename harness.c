@@ -1,10 +1,18 @@
 /* Test support code */
 
+#define _GNU_SOURCE /* dladdr */
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/single_threaded.h>
 #include <unistd.h>
 
 #include "report.h"
@@ -18,6 +26,12 @@
 /* Value at start of every allocated block */
 #define MAGICHEADER 0xdeadbeef
 
+/* Value at start of every block left unchecked in fast mode instead */
+#define MAGICUNCHECKED 0xfeedbeef
+
+/* Value at start of every block placed against a guard page instead */
+#define MAGICGUARDED 0xdeadfeed
+
 /* Value when deallocate block */
 #define MAGICFREE 0xffffffff
 
@@ -30,36 +44,121 @@
 /* Data structures used by our code */
 
 /*
- * Represent allocated blocks as doubly-linked list, with
- * next and prev pointers at beginning
+ * Header of every allocated block, the payload following it.  The header
+ * keeps the 32 bytes it had when it linked the blocks in a list: the short
+ * strings of the traces then take 64-byte chunks of malloc rather than
+ * 48-byte ones, with which the unrolled queue was found to take over twice
+ * as long to free millions of them.
+ *
+ * Packed, as the payload of a block placed against a guard page may be
+ * aligned to a byte only, and so may its header.
  */
-typedef struct BELE {
-    struct BELE *next, *prev;
+typedef struct __attribute__((packed)) BELE {
+    void *site; /* Where malloc was called from, if profiling, or NULL */
+    struct REGISTRY *registry; /* Registry a checked block is in */
     size_t payload_size;
     size_t magic_header; /* Marker to see if block seems legitimate */
     unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_ele_t;
 
-static block_ele_t *allocated = NULL;
-static size_t allocated_count = 0;
+/*
+ * Registry of the blocks allocated by a thread, each thread allocating
+ * through one of its own so that threads do not contend.  The checked
+ * blocks are kept in a set, so that cautious mode checks a block in
+ * constant time.  Open addressing with linear probing, in a table allocated
+ * with the real malloc, of a power of two size at least twice the number of
+ * blocks.  NULL marks empty slots.  A block points to the registry it is
+ * in, which whatever thread frees it locks to take it out.
+ *
+ * live counts the blocks the thread allocated less those it freed, which
+ * may be allocated by others, so it may fall below zero.  Only the thread
+ * updates it, and allocation_check sums it over the registries.
+ *
+ * Registries are never freed, as their blocks may outlive their threads:
+ * the registry of a thread that exited goes to the next thread needing one.
+ */
+typedef struct REGISTRY {
+    pthread_mutex_t lock; /* Held while the set is used */
+    block_ele_t **set;
+    size_t set_size, set_count;
+    int set_bits; /* log2 of set_size */
+    atomic_long live;
+    bool in_use; /* Whether a thread has it, under registries_lock */
+    struct REGISTRY *next;
+} registry_t;
+
+/* All registries, which are only ever added in front */
+static _Atomic(registry_t *) registries = NULL;
+static pthread_mutex_t registries_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Registry of this thread, once it allocated or freed */
+static _Thread_local registry_t *thread_registry = NULL;
+
+/* Gives the registry of a thread back as it exits */
+static pthread_key_t registry_key;
+static pthread_once_t registry_key_once = PTHREAD_ONCE_INIT;
+
+/* Smallest size of the set of a registry */
+#define BLOCK_SET_MIN 1024
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* One block in fast_sample is checked, or all if not positive */
+int fast_sample = 0;
+
+/* Blocks to allocate before the next one checked in fast mode */
+static _Thread_local int sample_countdown = 0;
+
+/* One block in guard_sample is placed against a guard page, or none */
+int guard_sample = 0;
+
+/* Blocks to allocate before the next guarded one */
+static _Thread_local int guard_countdown = 0;
+
+/* Whether a guarded block could not be mapped, which is reported once */
+static atomic_bool guard_failed = false;
+
+/* Whether blocks record their call sites */
+int heap_profile = 0;
+
+/*
+ * Blocks and bytes allocated from a call site, live and since profiling
+ * started
+ */
+typedef struct {
+    void *site; /* NULL if the record is unused */
+    size_t blocks, bytes;
+    size_t total_blocks, total_bytes;
+} site_t;
+
+/*
+ * Records of the call sites, in an open addressing table like the sets of
+ * the registries, allocated with the real malloc.  Records are never
+ * removed.  Guarded by site_lock.
+ */
+static site_t *site_table = NULL;
+static size_t site_table_size = 0;
+static size_t site_count = 0;
+static pthread_mutex_t site_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Smallest size of site_table */
+#define SITE_TABLE_MIN 64
+
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
-static bool error_occurred = false;
-static char *error_message = "";
+static atomic_bool error_occurred = false;
 
 static int time_limit = 1;
 
 /*
- * Data for managing exceptions
+ * Data for managing exceptions, of each thread
  */
-static jmp_buf env;
-static volatile sig_atomic_t jmp_ready = false;
-static bool time_limited = false;
+static _Thread_local char *error_message = "";
+static _Thread_local jmp_buf env;
+static _Thread_local volatile sig_atomic_t jmp_ready = false;
+static _Thread_local bool time_limited = false;
 
 /*
  * Internal functions
@@ -68,15 +167,341 @@ static bool time_limited = false;
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
+    if (fail_probability <= 0)
+        return false;
     double weight = (double) random() / RAND_MAX;
     return (weight < 0.01 * fail_probability);
 }
 
 /*
- * Find header of block, given its payload.
+ * Slot of the set of r where probing for b starts.  Blocks allocated one
+ * after the other mostly lie next to each other, and so do their slots, so
+ * that freeing a queue walks the table rather than missing the cache on
+ * every block.  The bits of the address above those of a slot are folded
+ * in, to spread the blocks lying farther apart than the table covers.
+ */
+static size_t block_slot(const registry_t *r, const block_ele_t *b)
+{
+    /* Blocks are aligned, the lowest bits of their addresses carry nothing */
+    size_t h = (uintptr_t) b >> 4;
+    return (h ^ (h >> r->set_bits)) & (r->set_size - 1);
+}
+
+/* Slot holding b, or the empty slot ending its probe sequence */
+static size_t block_find(const registry_t *r, const block_ele_t *b)
+{
+    size_t i = block_slot(r, b);
+    while (r->set[i] && r->set[i] != b)
+        i = (i + 1) & (r->set_size - 1);
+    return i;
+}
+
+/* Resize the set of r to size slots.  Return false if out of memory */
+static bool block_set_resize(registry_t *r, size_t size)
+{
+    block_ele_t **old = r->set;
+    size_t old_size = r->set_size;
+    block_ele_t **new_set = calloc(size, sizeof(block_ele_t *));
+    if (!new_set)
+        return false;
+
+    r->set = new_set;
+    r->set_size = size;
+    r->set_bits = __builtin_ctzl(size);
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i])
+            r->set[block_find(r, old[i])] = old[i];
+    }
+    free(old);
+    return true;
+}
+
+/* Add b to the set of r, which must be locked */
+static bool block_set_add(registry_t *r, block_ele_t *b)
+{
+    /* Keep the table at most half full */
+    if (2 * (r->set_count + 1) > r->set_size &&
+        !block_set_resize(r, r->set_size ? 2 * r->set_size : BLOCK_SET_MIN))
+        return false;
+    r->set[block_find(r, b)] = b;
+    r->set_count++;
+    b->registry = r;
+    return true;
+}
+
+/*
+ * Remove b from the set of r, which must be locked.  Return false if it was
+ * not in it.  Leaving no tombstone, the blocks following it in its run move
+ * back into the hole when their probe sequence passes through it.
+ */
+static bool block_set_remove(registry_t *r, const block_ele_t *b)
+{
+    if (!r->set_size)
+        return false;
+    size_t hole = block_find(r, b);
+    if (!r->set[hole])
+        return false;
+
+    size_t mask = r->set_size - 1;
+    r->set[hole] = NULL;
+    r->set_count--;
+    for (size_t i = (hole + 1) & mask; r->set[i]; i = (i + 1) & mask) {
+        size_t home = block_slot(r, r->set[i]);
+        /* Does the probe sequence of r->set[i] run from home past hole? */
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            r->set[hole] = r->set[i];
+            r->set[i] = NULL;
+            hole = i;
+        }
+    }
+    return true;
+}
+
+/*
+ * Lock r, unless the process has a single thread, leaving none to exclude.
+ * A locked instruction would keep the cache misses of freeing a block from
+ * overlapping those of freeing the next one, which makes freeing a long
+ * queue take half as long again.  Return whether locked.
+ */
+static bool registry_lock(registry_t *r)
+{
+    if (__libc_single_threaded)
+        return false;
+    pthread_mutex_lock(&r->lock);
+    return true;
+}
+
+static void registry_unlock(registry_t *r, bool locked)
+{
+    if (locked)
+        pthread_mutex_unlock(&r->lock);
+}
+
+/* Let the next thread needing a registry have r, of a thread exiting */
+static void registry_release(void *r)
+{
+    pthread_mutex_lock(&registries_lock);
+    ((registry_t *) r)->in_use = false;
+    pthread_mutex_unlock(&registries_lock);
+}
+
+static void registry_key_create()
+{
+    pthread_key_create(&registry_key, registry_release);
+}
+
+/* Registry of this thread, taken over or made on the first call */
+static registry_t *get_registry()
+{
+    if (__builtin_expect(thread_registry != NULL, 1))
+        return thread_registry;
+
+    pthread_once(&registry_key_once, registry_key_create);
+    pthread_mutex_lock(&registries_lock);
+    registry_t *r = atomic_load(&registries);
+    while (r && r->in_use)
+        r = r->next;
+    if (!r) {
+        r = calloc(1, sizeof(registry_t));
+        if (!r)
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        pthread_mutex_init(&r->lock, NULL);
+        r->next = atomic_load(&registries);
+        atomic_store(&registries, r);
+    }
+    r->in_use = true;
+    pthread_mutex_unlock(&registries_lock);
+
+    pthread_setspecific(registry_key, r);
+    thread_registry = r;
+    return r;
+}
+
+/* Is r one of the registries, rather than whatever a bad header holds? */
+static bool registry_known(const registry_t *r)
+{
+    for (registry_t *k = atomic_load(&registries); k; k = k->next) {
+        if (k == r)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Take b out of the registry it is in.  Return false if it is in none.
+ * The registry of this thread, self, is looked in first, as it mostly has
+ * the blocks the thread frees: b only tells its registry once its header
+ * is read, which mostly misses the cache, while looking in self overlaps
+ * with that.
+ */
+static bool block_unregister(registry_t *self, block_ele_t *b)
+{
+    bool locked = registry_lock(self);
+    bool found = block_set_remove(self, b);
+    registry_unlock(self, locked);
+    if (found)
+        return true;
+
+    registry_t *r = b->registry;
+    if (r == self || !registry_known(r))
+        return false;
+    locked = registry_lock(r);
+    found = block_set_remove(r, b);
+    registry_unlock(r, locked);
+    return found;
+}
+
+/*
+ * Count n more live blocks in r, the registry of this thread.  Relaxed
+ * atomics cost no more than plain loads and stores, this thread being the
+ * only one to write the count.
+ */
+static void count_blocks(registry_t *r, long n)
+{
+    long live = atomic_load_explicit(&r->live, memory_order_relaxed);
+    atomic_store_explicit(&r->live, live + n, memory_order_relaxed);
+}
+
+/* Should the block allocated next be placed against a guard page? */
+static bool guard_block()
+{
+    if (guard_sample <= 0)
+        return false;
+    if (--guard_countdown > 0)
+        return false;
+    guard_countdown = guard_sample;
+    return true;
+}
+
+static size_t page_size()
+{
+    static size_t size = 0;
+    if (!size)
+        size = (size_t) sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+/* Bytes mapped for a guarded block of size bytes, guard page included */
+static size_t guard_map_size(size_t size)
+{
+    size_t page = page_size();
+    return ((sizeof(block_ele_t) + size + page - 1) & ~(page - 1)) + page;
+}
+
+/*
+ * Map a block for a payload of size bytes ending right where a page
+ * allowing no access begins, so that reading or writing past its end faults
+ * at once.  The payload is thus aligned only as much as its size is a
+ * multiple of, to a byte for odd sizes: slack after it would hide accesses.
+ * Return NULL if could not.
+ */
+static block_ele_t *guard_alloc(size_t size)
+{
+    size_t page = page_size();
+    if (size > SIZE_MAX - sizeof(block_ele_t) - 2 * page)
+        return NULL;
+    size_t map_size = guard_map_size(size);
+    unsigned char *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    unsigned char *guard = map + map_size - page;
+    if (mprotect(guard, page, PROT_NONE) != 0) {
+        munmap(map, map_size);
+        return NULL;
+    }
+    return (block_ele_t *) (guard - size - sizeof(block_ele_t));
+}
+
+/* Unmap guarded block b, so that accesses to it fault as well */
+static void guard_free(block_ele_t *b)
+{
+    size_t map_size = guard_map_size(b->payload_size);
+    unsigned char *guard = b->payload + b->payload_size;
+    munmap(guard + page_size() - map_size, map_size);
+}
+
+/* Should the block allocated next be checked? */
+static bool sample_block()
+{
+    if (fast_sample <= 0)
+        return true;
+    if (--sample_countdown > 0)
+        return false;
+    sample_countdown = fast_sample;
+    return true;
+}
+
+/* Slot of site_table holding site, or the empty slot where it would go */
+static size_t site_find(const void *site)
+{
+    uint64_t h = (uint64_t) (uintptr_t) site * 0x9e3779b97f4a7c15ULL;
+    size_t i = (size_t) (h >> 32) & (site_table_size - 1);
+    while (site_table[i].site && site_table[i].site != site)
+        i = (i + 1) & (site_table_size - 1);
+    return i;
+}
+
+/* Record of site, added if new.  NULL if out of memory */
+static site_t *site_record(void *site)
+{
+    if (2 * (site_count + 1) > site_table_size) {
+        size_t size = site_table_size ? 2 * site_table_size : SITE_TABLE_MIN;
+        site_t *old = site_table;
+        size_t old_size = site_table_size;
+        site_t *new_table = calloc(size, sizeof(site_t));
+        if (!new_table)
+            return NULL;
+        site_table = new_table;
+        site_table_size = size;
+        for (size_t i = 0; i < old_size; i++) {
+            if (old[i].site)
+                site_table[site_find(old[i].site)] = old[i];
+        }
+        free(old);
+    }
+
+    size_t i = site_find(site);
+    if (!site_table[i].site) {
+        site_table[i].site = site;
+        site_count++;
+    }
+    return &site_table[i];
+}
+
+/* Charge block b, allocated from site, to the site */
+static void profile_alloc(block_ele_t *b, void *site)
+{
+    pthread_mutex_lock(&site_lock);
+    site_t *r = site_record(site);
+    if (r) {
+        b->site = site;
+        r->blocks++;
+        r->bytes += b->payload_size;
+        r->total_blocks++;
+        r->total_bytes += b->payload_size;
+    }
+    pthread_mutex_unlock(&site_lock);
+}
+
+/* Return block b, being freed, from its site */
+static void profile_free(block_ele_t *b)
+{
+    pthread_mutex_lock(&site_lock);
+    site_t *r = site_table_size ? &site_table[site_find(b->site)] : NULL;
+    if (r && r->site && r->blocks > 0) {
+        r->blocks--;
+        r->bytes -= b->payload_size;
+    }
+    pthread_mutex_unlock(&site_lock);
+}
+
+/*
+ * Find header of block, given its payload, and take the block out of its
+ * registry, self being the one of this thread.
  * Signal error if doesn't seem like legitimate block
  */
-static block_ele_t *find_header(void *p)
+static block_ele_t *find_header(void *p, registry_t *self)
 {
     if (!p) {
         report_event(MSG_ERROR, "Attempting to free null block");
@@ -84,15 +509,15 @@ static block_ele_t *find_header(void *p)
     }
 
     block_ele_t *b = (block_ele_t *) ((size_t) p - sizeof(block_ele_t));
+    /* Unchecked blocks are not in the set, their header is all there is */
+    if (b->magic_header == MAGICUNCHECKED)
+        return b;
+
+    /* Taking the block out tells whether it really is an allocated one */
+    bool registered = block_unregister(self, b);
     if (cautious_mode) {
         /* Make sure this is really an allocated block */
-        block_ele_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
+        if (!registered) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
@@ -100,7 +525,7 @@ static block_ele_t *find_header(void *p)
         }
     }
 
-    if (b->magic_header != MAGICHEADER) {
+    if (b->magic_header != MAGICHEADER && b->magic_header != MAGICGUARDED) {
         report_event(
             MSG_ERROR,
             "Attempted to free unallocated or corrupted block.  Address = %p",
@@ -120,9 +545,12 @@ static size_t *find_footer(block_ele_t *b)
 }
 
 /*
- * Implementation of application functions
+ * Allocate a block of size bytes for a call of malloc, calloc or strdup
+ * from site.  The site is the return address of the call, which each of
+ * them takes itself, as the one of a function inlined into another would be
+ * the one of the latter.
  */
-void *test_malloc(size_t size)
+static void *alloc_block(size_t size, void *site)
 {
     if (noallocate_mode) {
         report_event(MSG_FATAL, "Calls to malloc disallowed");
@@ -134,33 +562,81 @@ void *test_malloc(size_t size)
         return NULL;
     }
 
-    block_ele_t *new_block =
-        malloc(size + sizeof(block_ele_t) + sizeof(size_t));
-    if (!new_block) {
+    /* Guarded blocks are always checked, but have no footer */
+    registry_t *r = get_registry();
+    bool guarded = guard_block();
+    bool checked = sample_block() || guarded;
+    block_ele_t *new_block = guarded ? guard_alloc(size) : NULL;
+    if (guarded && !new_block) {
+        if (!atomic_exchange(&guard_failed, true))
+            report_event(MSG_WARN,
+                         "Could not map a guard page, allocating block "
+                         "unguarded.  Later such blocks are not reported");
+        guarded = false;
+    }
+    if (!guarded)
+        new_block = malloc(size + sizeof(block_ele_t) + sizeof(size_t));
+    bool ok = new_block != NULL;
+    if (ok && checked) {
+        bool locked = registry_lock(r);
+        ok = block_set_add(r, new_block);
+        registry_unlock(r, locked);
+    }
+    if (!ok) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
         error_occurred = true;
     }
 
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
-    *find_footer(new_block) = MAGICFOOTER;
+    new_block->site = NULL;
+    if (__builtin_expect(heap_profile, 0))
+        profile_alloc(new_block, site);
     void *p = (void *) &new_block->payload;
-    memset(p, FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
+    count_blocks(r, 1);
+    if (!checked) {
+        // cppcheck-suppress nullPointerRedundantCheck
+        new_block->magic_header = MAGICUNCHECKED;
+        return p;
+    }
 
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    // cppcheck-suppress nullPointerRedundantCheck
+    new_block->magic_header = guarded ? MAGICGUARDED : MAGICHEADER;
+    if (!guarded)
+        *find_footer(new_block) = MAGICFOOTER;
+    memset(p, FILLCHAR, size);
 
     return p;
 }
 
+/*
+ * Implementation of application functions
+ */
+void *test_malloc(size_t size)
+{
+    return alloc_block(size, __builtin_return_address(0));
+}
+
+void *test_malloc_guarded(size_t size)
+{
+    block_ele_t *b = guard_alloc(size);
+    if (!b)
+        return NULL;
+    b->payload_size = size;
+    b->site = NULL;
+    b->magic_header = MAGICGUARDED;
+    registry_t *r = get_registry();
+    bool locked = registry_lock(r);
+    bool ok = block_set_add(r, b);
+    registry_unlock(r, locked);
+    if (!ok) {
+        guard_free(b);
+        return NULL;
+    }
+    count_blocks(r, 1);
+    return b->payload;
+}
+
 // cppcheck-suppress unusedFunction
 void *test_calloc(size_t nelem, size_t elsize)
 {
@@ -168,7 +644,7 @@ void *test_calloc(size_t nelem, size_t elsize)
      * https://danluu.com/malloc-tutorial/
      */
     size_t size = nelem * elsize;  // TODO: check for overflow
-    void *ptr = test_malloc(size);
+    void *ptr = alloc_block(size, __builtin_return_address(0));
     memset(ptr, 0, size);
     return ptr;
 }
@@ -183,7 +659,23 @@ void test_free(void *p)
     if (!p)
         return;
 
-    block_ele_t *b = find_header(p);
+    registry_t *r = get_registry();
+    block_ele_t *b = find_header(p, r);
+    if (__builtin_expect(b->site != NULL, 0))
+        profile_free(b);
+    if (b->magic_header == MAGICUNCHECKED) {
+        b->magic_header = MAGICFREE;
+        free(b);
+        count_blocks(r, -1);
+        return;
+    }
+
+    if (b->magic_header == MAGICGUARDED) {
+        guard_free(b);
+        count_blocks(r, -1);
+        return;
+    }
+
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
         report_event(MSG_ERROR,
@@ -196,25 +688,15 @@ void test_free(void *p)
     *find_footer(b) = MAGICFREE;
     memset(p, FILLCHAR, b->payload_size);
 
-    /* Unlink from list */
-    block_ele_t *bn = b->next;
-    block_ele_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
-    else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
-
     free(b);
-    allocated_count--;
+    count_blocks(r, -1);
 }
 
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    void *new = alloc_block(len, __builtin_return_address(0));
     if (!new)
         return NULL;
 
@@ -223,7 +705,197 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    long live = 0;
+    for (registry_t *r = atomic_load(&registries); r; r = r->next)
+        live += atomic_load_explicit(&r->live, memory_order_relaxed);
+    return live;
+}
+
+/*
+ * Describe the call returning to addr: function, file and line as
+ * addr2line finds them in the debugging information, or else the nearest
+ * symbol dladdr finds, or else the bare address.  addr2line is only run if
+ * lines, which a signal handler must not ask for, as popen is not safe there.
+ */
+static void describe_site(void *addr, char *buf, size_t len, bool lines)
+{
+    Dl_info info;
+    if (!dladdr(addr, &info) || !info.dli_fname) {
+        snprintf(buf, len, "%p", addr);
+        return;
+    }
+
+    /* Addresses in position independent objects are relative to them */
+    uintptr_t a = (uintptr_t) addr;
+    if (((const ElfW(Ehdr) *) info.dli_fbase)->e_type == ET_DYN)
+        a -= (uintptr_t) info.dli_fbase;
+    /* The program itself may have been run by a relative path */
+    Dl_info self;
+    char exe[MAX_CHAR];
+    const char *object = info.dli_fname;
+    if (dladdr((void *) describe_site, &self) &&
+        self.dli_fbase == info.dli_fbase) {
+        ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (n > 0) {
+            exe[n] = '\0';
+            object = exe;
+        }
+    }
+
+    char cmd[MAX_CHAR];
+    char func[MAX_CHAR] = "", line[MAX_CHAR] = "";
+    FILE *out = NULL;
+    /* The call instruction lies before the address it returns to */
+    if (lines && !strchr(object, '\'') &&
+        snprintf(cmd, sizeof(cmd), "addr2line -f -s -e '%s' %#lx 2>/dev/null",
+                 object, (unsigned long) a - 1) < (int) sizeof(cmd))
+        out = popen(cmd, "r");
+    if (out) {
+        if (!fgets(func, sizeof(func), out) || !fgets(line, sizeof(line), out))
+            func[0] = '\0';
+        pclose(out);
+    }
+    func[strcspn(func, "\n")] = '\0';
+    /* Drop the discriminator addr2line may follow the line with */
+    line[strcspn(line, " \n")] = '\0';
+
+    if (func[0] && strcmp(func, "??"))
+        snprintf(buf, len, "%s (%s)", func, line);
+    else if (info.dli_sname)
+        snprintf(buf, len, "%s+%#lx", info.dli_sname,
+                 (unsigned long) ((uintptr_t) addr -
+                                  (uintptr_t) info.dli_saddr));
+    else
+        snprintf(buf, len, "%s+%#lx", info.dli_fname, (unsigned long) a);
+}
+
+/* Guarded block of r whose guard page holds address a, or NULL */
+static block_ele_t *guard_find(const registry_t *r, uintptr_t a)
+{
+    for (size_t i = 0; i < r->set_size; i++) {
+        block_ele_t *b = r->set[i];
+        if (!b || b->magic_header != MAGICGUARDED)
+            continue;
+        uintptr_t end = (uintptr_t) b->payload + b->payload_size;
+        if (a >= end && a - end < page_size())
+            return b;
+    }
+    return NULL;
+}
+
+bool guard_overrun(void *addr, char *buf, size_t len)
+{
+    /*
+     * A registry another thread is changing is skipped rather than waited
+     * for, which could be forever should the faulting thread hold its lock
+     */
+    block_ele_t *b = NULL;
+    for (registry_t *r = atomic_load(&registries); r && !b; r = r->next) {
+        if (pthread_mutex_trylock(&r->lock) != 0)
+            continue;
+        b = guard_find(r, (uintptr_t) addr);
+        pthread_mutex_unlock(&r->lock);
+    }
+    if (!b)
+        return false;
+
+    uintptr_t end = (uintptr_t) b->payload + b->payload_size;
+    int n = snprintf(buf, len, "Access to byte %zu of block %p of %zu bytes",
+                     (size_t) ((uintptr_t) addr - end) + b->payload_size,
+                     (void *) b->payload, b->payload_size);
+    if (b->site && n >= 0 && (size_t) n < len) {
+        char site[MAX_CHAR];
+        describe_site(b->site, site, sizeof(site), false);
+        snprintf(buf + n, len - n, ", allocated at %s", site);
+    }
+    return true;
+}
+
+/* Order call sites by decreasing live bytes */
+static int site_cmp(const void *a, const void *b)
+{
+    size_t x = ((const site_t *) a)->bytes, y = ((const site_t *) b)->bytes;
+    return (x < y) - (x > y);
+}
+
+/*
+ * Report live bytes and blocks by call site, the most bytes first.
+ * Return the number of live blocks profiled.
+ */
+size_t heap_profile_show()
+{
+    pthread_mutex_lock(&site_lock);
+    site_t *live = malloc((site_count ? site_count : 1) * sizeof(site_t));
+    if (!live) {
+        pthread_mutex_unlock(&site_lock);
+        report_event(MSG_WARN, "Couldn't allocate memory for heap profile");
+        return 0;
+    }
+
+    size_t n = 0, blocks = 0, bytes = 0;
+    for (size_t i = 0; i < site_table_size; i++) {
+        if (site_table[i].site && site_table[i].blocks) {
+            live[n++] = site_table[i];
+            blocks += site_table[i].blocks;
+            bytes += site_table[i].bytes;
+        }
+    }
+    pthread_mutex_unlock(&site_lock);
+    qsort(live, n, sizeof(site_t), site_cmp);
+
+    report(1, "%12s %10s  %s", "Bytes", "Blocks", "Call site");
+    for (size_t i = 0; i < n; i++) {
+        char desc[MAX_CHAR];
+        describe_site(live[i].site, desc, sizeof(desc), true);
+        report(1, "%12zu %10zu  %s", live[i].bytes, live[i].blocks, desc);
+    }
+    report(1, "%12zu %10zu  Total", bytes, blocks);
+    free(live);
+    return blocks;
+}
+
+/*
+ * Write the heap profile to file_name in the legacy heap profile format of
+ * pprof, in use and allocated space by call site followed by the memory
+ * map, which pprof symbolizes against.  Return false if could not.
+ */
+bool heap_profile_dump(const char *file_name)
+{
+    FILE *f = fopen(file_name, "w");
+    if (!f)
+        return false;
+
+    pthread_mutex_lock(&site_lock);
+    size_t blocks = 0, bytes = 0, total_blocks = 0, total_bytes = 0;
+    for (size_t i = 0; i < site_table_size; i++) {
+        blocks += site_table[i].blocks;
+        bytes += site_table[i].bytes;
+        total_blocks += site_table[i].total_blocks;
+        total_bytes += site_table[i].total_bytes;
+    }
+    fprintf(f, "heap profile: %6zu: %8zu [%6zu: %8zu] @ heapprofile\n", blocks,
+            bytes, total_blocks, total_bytes);
+    /* pprof takes the first address as the one of the call itself */
+    for (size_t i = 0; i < site_table_size; i++) {
+        site_t *r = &site_table[i];
+        if (r->site)
+            fprintf(f, "%6zu: %8zu [%6zu: %8zu] @ %#018lx\n", r->blocks,
+                    r->bytes, r->total_blocks, r->total_bytes,
+                    (unsigned long) (uintptr_t) r->site - 1);
+    }
+    pthread_mutex_unlock(&site_lock);
+
+    fprintf(f, "\nMAPPED_LIBRARIES:\n");
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps) {
+        char buf[MAX_CHAR];
+        size_t len;
+        while ((len = fread(buf, 1, sizeof(buf), maps)) > 0)
+            fwrite(buf, 1, len, f);
+        fclose(maps);
+    }
+    bool ok = maps && !ferror(f);
+    return fclose(f) == 0 && ok;
 }
 
 /*
@@ -253,9 +925,7 @@ void set_noallocate_mode(bool noallocate)
  */
 bool error_check()
 {
-    bool e = error_occurred;
-    error_occurred = false;
-    return e;
+    return atomic_exchange(&error_occurred, false);
 }
 
 /*
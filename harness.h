@@ -9,6 +9,10 @@
  * This test harness enables us to do stringent testing of code.
  * It overloads the library versions of malloc and free with ones that
  * allow checking for common allocation errors.
+ *
+ * Threads may allocate and free blocks concurrently, each through a
+ * registry of its own, and free the blocks of one another.  The settings
+ * below are shared, and should not change while threads allocate.
  */
 
 void *test_malloc(size_t size);
@@ -19,12 +23,88 @@ char *test_strdup(const char *s);
 
 #ifdef INTERNAL
 
-/* Report number of allocated blocks */
+/*
+ * Report number of allocated blocks, by all threads.  Exact once those
+ * allocating are done, being summed over their registries.
+ */
 size_t allocation_check();
 
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/*
+ * Fast mode, for performance traces whose run time the checks would
+ * otherwise dominate.  When fast_sample is positive, only one block in
+ * fast_sample, every fast_sample-th allocated, is checked as usual; the
+ * others are neither filled on allocation nor on free, have no footer, and
+ * are left out of the set cautious mode looks blocks up in.  Nothing changes
+ * when it is not positive, the default.
+ *
+ * The checked blocks keep every guarantee: freeing one twice is reported,
+ * so is a write past its end, and reading one before writing it or after
+ * freeing it reads bytes 0x55.  Of an unchecked block, only a magic number
+ * at its start is checked on free, which catches freeing it twice unless
+ * its memory was allocated again in the meantime.  Writes past its end and
+ * reads of stale contents go unnoticed, and so may freeing an address that
+ * is not a block, when the word before it holds that magic number.
+ * allocation_check counts all blocks either way.
+ */
+extern int fast_sample;
+
+/*
+ * Guarded mode, after Electric Fence.  When guard_sample is positive, one
+ * block in guard_sample, every guard_sample-th allocated, gets pages of its
+ * own, its payload ending right before a page mapped without any access, so
+ * that reading or writing past its end faults at once rather than when the
+ * block is freed.  Its pages are unmapped on free, so that using it after
+ * that faults too, until the addresses are mapped again.  Guarded blocks
+ * are always checked, whatever fast_sample.
+ *
+ * A guarded block takes two pages at least, and a mapping of its own, of
+ * which the kernel allows some tens of thousands: a block that cannot be
+ * mapped is allocated as usual, which is reported once.  Its payload is
+ * aligned only as much as its size is a multiple of, up to a page.
+ */
+extern int guard_sample;
+
+/*
+ * If addr, where an access faulted, lies in the guard page of a block,
+ * describe the block and the access in buf, of len bytes, and return true.
+ * Not async-signal-safe: it formats with snprintf and names the call site
+ * with dladdr.  A SIGSEGV handler may call it only as a best effort at
+ * reporting a fault the program then dies of.  A registry locked at the
+ * time of the fault is skipped rather than waited for, so the block may go
+ * unnamed.
+ */
+bool guard_overrun(void *addr, char *buf, size_t len);
+
+/*
+ * Allocate size bytes against a guard page, whatever guard_sample, for
+ * buffers the tester passes to the code under test.  Calls to malloc
+ * failing or being disallowed do not apply.  Free with test_free.
+ * Return NULL if could not map the pages.
+ */
+void *test_malloc_guarded(size_t size);
+
+/*
+ * Heap profiling.  While heap_profile is set, every block records the
+ * return address of its call to malloc, calloc or strdup, and live and
+ * allocated bytes and blocks are counted by call site.  Blocks allocated
+ * while it is not set are not counted, even once it is.
+ */
+extern int heap_profile;
+
+/*
+ * Report live bytes and blocks by call site, the most bytes first.
+ * Return the number of live blocks profiled.
+ */
+size_t heap_profile_show();
+
+/*
+ * Write the heap profile to file_name for pprof.  Return false if could not
+ */
+bool heap_profile_dump(const char *file_name);
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -38,13 +118,19 @@ void set_cautious_mode(bool cautious);
 void set_noallocate_mode(bool noallocate);
 
 /*
-  Return whether any errors have occurred since last time checked
+  Return whether any errors have occurred since last time checked, in any
+  thread
  */
 bool error_check();
 
 /*
  * Prepare for a risky operation using setjmp.
  * Function returns true for initial return, false for error return
+ *
+ * Each thread has an exception context of its own, which trigger_exception
+ * returns to.  The time limit, however, is the alarm of the process: one
+ * thread at a time may ask for it, and the others should block SIGALRM, so
+ * that it is delivered to that thread.
  */
 bool exception_setup(bool limit_time);
 
@@ -54,7 +140,8 @@ bool exception_setup(bool limit_time);
 void exception_cancel();
 
 /*
- * Use longjmp to return to most recent exception setup.  Include error message
+ * Use longjmp to return to most recent exception setup of this thread.
+ * Include error message
  */
 void trigger_exception(char *msg);
 
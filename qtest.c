@@ -2,12 +2,12 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h> /* strcasecmp */
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
@@ -25,15 +25,14 @@
 #define STRINGPAD MAXSTRING
 
 /*
- * It is a bit sketchy to use this #include file on the solution version of the
- * code.
- * OK as long as head field of queue_t structure is in first position in
- * solution code
+ * The queue is only inspected through the q_peek_* and q_iter_* helpers
+ * declared next to queue_t, so any representation selected in queue.h works.
  */
 #include "queue.h"
 
 #include "console.h"
 #include "report.h"
+#include "strcmp_simd.h"
 
 /* Settable parameters */
 
@@ -42,7 +41,6 @@
 /*
  * How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the list
  */
 #define BIG_QUEUE 30
 static int big_queue_size = BIG_QUEUE;
@@ -55,12 +53,53 @@ static queue_t *q = NULL;
 /* Number of elements in queue */
 static size_t qcnt = 0;
 
+/*
+ * Queues set aside, with their numbers of elements.  The queue being tested
+ * is queues[qcur], but it lives in q and qcnt while it is current, and its
+ * q and cnt here are only brought up to date by the switch command.
+ *
+ * For leak detection, the blocks allocated while a queue is current, less
+ * those freed, count toward its pool.  A queue whose elements another takes
+ * by splice, split or merge joins the pool of the latter, as blocks may then
+ * move between them.  A pool is held in the blocks entry of one of its live
+ * queues, which every member names in its pool entry, and whatever is left
+ * in it once its last queue is freed leaked.
+ */
+#define NQUEUES 128
+static struct {
+    queue_t *q;
+    size_t cnt;
+    int pool;
+    long blocks;
+} queues[NQUEUES];
+static int qcur = 0;
+
+/* Allocated blocks counted toward pools so far */
+static size_t blocks_counted = 0;
+
+#ifdef QUEUE_LIST
+/*
+ * Handles saved by the mark command for erase to remove the elements by.
+ * A handle stays valid until its element is removed, whatever happens to
+ * the queue in between, which is what erase then tests.  Removing the
+ * element drops its marks.
+ */
+#define NMARKS 16
+static list_ele_t *marks[NMARKS];
+#endif
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_QUEUE;
 static int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
+/* Memory budget of esort, in bytes */
+static int sort_budget = 1 << 20;
+
+/* String comparison kernel, see strcmp_simd.h */
+static int cmp_kernel;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -73,13 +112,35 @@ static bool do_insert_head(int argc, char *argv[]);
 static bool do_insert_tail(int argc, char *argv[]);
 static bool do_remove_head(int argc, char *argv[]);
 static bool do_remove_head_quiet(int argc, char *argv[]);
+static bool do_remove_head_bulk(int argc, char *argv[]);
+static bool do_remove_tail(int argc, char *argv[]);
+static bool do_remove_tail_quiet(int argc, char *argv[]);
+#ifdef QUEUE_LIST
+static bool do_mark(int argc, char *argv[]);
+static bool do_erase(int argc, char *argv[]);
+#endif
 static bool do_reverse(int argc, char *argv[]);
 static bool do_size(int argc, char *argv[]);
 static bool do_sort(int argc, char *argv[]);
+static bool do_psort(int argc, char *argv[]);
+static bool do_esort(int argc, char *argv[]);
+static bool do_dedup(int argc, char *argv[]);
 static bool do_show(int argc, char *argv[]);
+static bool do_switch(int argc, char *argv[]);
+static bool do_splice(int argc, char *argv[]);
+static bool do_split(int argc, char *argv[]);
+static bool do_merge(int argc, char *argv[]);
+static bool do_heapprof(int argc, char *argv[]);
+static bool do_stress(int argc, char *argv[]);
 
 static void queue_init();
 
+/* Use the kernel option simd asks for, or the fastest one supported */
+static void set_cmp_kernel(int oldval)
+{
+    cmp_kernel = str_cmp_select(cmp_kernel);
+}
+
 static void console_init()
 {
     add_cmd("new", do_new, "                | Create new queue");
@@ -93,21 +154,166 @@ static void console_init()
     add_cmd("rh", do_remove_head,
             " [str]          | Remove from head of queue.  Optionally compare "
             "to expected value str");
-    add_cmd(
-        "rhq", do_remove_head_quiet,
-        "                | Remove from head of queue without reporting value.");
+    add_cmd("rhq", do_remove_head_quiet,
+            " [n]            | Remove n elements from head of queue without "
+            "reporting values. (default: n == 1)");
+    add_cmd("rhn", do_remove_head_bulk,
+            " n              | Remove n elements from head of queue, copying "
+            "their strings out in batches");
+    add_cmd("rt", do_remove_tail,
+            " [str]          | Remove from tail of queue.  Optionally compare "
+            "to expected value str");
+    add_cmd("rtq", do_remove_tail_quiet,
+            " [n]            | Remove n elements from tail of queue without "
+            "reporting values. (default: n == 1)");
+#ifdef QUEUE_LIST
+    add_cmd("mark", do_mark,
+            " m pos          | Save the handle of the element at position pos "
+            "(0 is head) as mark m");
+    add_cmd("erase", do_erase,
+            " m [str]        | Remove the element of mark m through its "
+            "handle.  Optionally compare to expected value str");
+#endif
     add_cmd("reverse", do_reverse, "                | Reverse queue");
-    add_cmd("sort", do_sort, "                | Sort queue in ascending order");
+    add_cmd("sort", do_sort,
+            " [desc] [nocase] | Sort queue in ascending order, or descending "
+            "with desc, ignoring case with nocase");
+    add_cmd("psort", do_psort,
+            " k              | Sort the k smallest elements in ascending "
+            "order at head of queue");
+    add_cmd("esort", do_esort,
+            " [dir]          | Sort queue in ascending order within the "
+            "memory budget, spilling to files in dir (default: $TMPDIR "
+            "or /tmp)");
+    add_cmd("dedup", do_dedup,
+            "                | Remove elements equal to the one before them");
     add_cmd("size", do_size,
             " [n]            | Compute queue size n times (default: n == 1)");
     add_cmd("show", do_show, "                | Show queue contents");
+    add_cmd("switch", do_switch,
+            " n              | Make queue n the one tested (0 initially)");
+    add_cmd("splice", do_splice,
+            " n              | Move all elements of queue n to tail of queue");
+    add_cmd("split", do_split,
+            " k n            | Move the elements after the first k ones of "
+            "queue to new queue n");
+    add_cmd("merge", do_merge,
+            " n ...          | Merge sorted queues n ... into sorted queue, "
+            "leaving them empty");
+    add_cmd("heapprof", do_heapprof,
+            " [file]         | Show live memory by call site, and write it "
+            "to file for pprof");
+    add_cmd("stress", do_stress,
+            " [t] [n]        | Make n random operations on a queue in each of "
+            "t threads, then on the next thread's, freeing it (default: t "
+            "== 4, n == 10000)");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
+    add_param("fast", &fast_sample,
+              "Check only one allocated block in this many (0: all)", NULL);
+    add_param("guard", &guard_sample,
+              "Place one allocated block in this many against a guard page "
+              "(0: none)",
+              NULL);
+    add_param("profile", &heap_profile,
+              "Whether malloc records call sites for heapprof", NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("nocase", &q_sort_nocase, "Whether sort ignores case", NULL);
+    add_param("budget", &sort_budget, "Memory budget of esort in bytes",
+              NULL);
+    cmp_kernel = str_cmp_select(str_cmp_best());
+    add_param("simd", &cmp_kernel,
+              "String comparison kernel (0: scalar, 1: SSE2, 2: AVX2), at "
+              "most the fastest the CPU supports",
+              set_cmp_kernel);
+#ifdef QUEUE_LIST
+    add_param("sort", &q_sort_engine,
+              "Sort algorithm (0: radix sort, 1: natural merge sort, "
+              "2: multikey quicksort, 3: burstsort)",
+              NULL);
+    add_param("sort_threads", &q_sort_threads,
+              "Number of threads sort may use", NULL);
+#endif
+}
+
+/*
+ * Count the blocks allocated or freed since last time toward the pool of
+ * the current queue
+ */
+static void count_pool_blocks()
+{
+    size_t blocks = allocation_check();
+    queues[queues[qcur].pool].blocks += (long) (blocks - blocks_counted);
+    blocks_counted = blocks;
+}
+
+/* Have queue n join the pool of the current queue, along with its pool */
+static void join_pool(int n)
+{
+    int from = queues[n].pool, to = queues[qcur].pool;
+    if (from == to)
+        return;
+    for (int i = 0; i < NQUEUES; i++)
+        if (queues[i].pool == from)
+            queues[i].pool = to;
+    queues[to].blocks += queues[from].blocks;
+    queues[from].blocks = 0;
+}
+
+/*
+ * Take the current queue, just freed, out of its pool.  Return the blocks
+ * leaked by the pool if it was the last one in it, else 0.
+ */
+static long leave_pool()
+{
+    int pool = queues[qcur].pool, next = -1;
+    for (int i = 0; i < NQUEUES && next < 0; i++)
+        if (i != qcur && queues[i].pool == pool && queues[i].q)
+            next = i;
+
+    long leaked = 0;
+    if (next < 0) {
+        leaked = queues[pool].blocks;
+        queues[pool].blocks = 0;
+    } else if (pool == qcur) {
+        /* The pool moves to a queue still in it */
+        for (int i = 0; i < NQUEUES; i++)
+            if (queues[i].pool == pool)
+                queues[i].pool = next;
+        queues[next].blocks = queues[pool].blocks;
+        queues[pool].blocks = 0;
+    }
+    queues[qcur].pool = qcur;
+    return leaked;
+}
+
+#ifdef QUEUE_LIST
+/*
+ * Drop the marks of elements no longer in any queue.  Commands that free
+ * elements call this, as the space of those may be reused by the next
+ * insert, and a mark left behind would then name the new element.
+ */
+static void drop_marks()
+{
+    list_ele_t *kept[NMARKS] = {NULL};
+    bool any = false;
+    for (int i = 0; i < NMARKS; i++)
+        any = any || marks[i];
+    for (int n = 0; any && n < NQUEUES; n++) {
+        queue_t *qn = n == qcur ? q : queues[n].q;
+        for (list_ele_t *e = qn ? qn->head : NULL; e; e = e->next)
+            for (int i = 0; i < NMARKS; i++)
+                if (marks[i] == e)
+                    kept[i] = e;
+    }
+    memcpy(marks, kept, sizeof(marks));
 }
+#else
+static void drop_marks() {}
+#endif
 
 static bool do_new(int argc, char *argv[])
 {
@@ -144,20 +350,21 @@ static bool do_free(int argc, char *argv[])
         report(3, "Warning: Calling free on null queue");
     error_check();
 
-    if (qcnt > big_queue_size)
-        set_cautious_mode(false);
+    count_pool_blocks();
     if (exception_setup(true))
         q_free(q);
     exception_cancel();
-    set_cautious_mode(true);
 
     q = NULL;
     qcnt = 0;
+    drop_marks();
     show_queue(3);
 
-    size_t bcnt = allocation_check();
+    /* Blocks of the queues set aside are no leak, unless in its pool */
+    count_pool_blocks();
+    long bcnt = leave_pool();
     if (bcnt > 0) {
-        report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
+        report(1, "ERROR: Freed queue, but %ld blocks are still allocated",
                bcnt);
         ok = false;
     }
@@ -180,10 +387,54 @@ static void fill_rand_string(char *buf, size_t buf_size)
     buf[len] = '\0';
 }
 
-static bool do_insert_head(int argc, char *argv[])
+/* Which end of the queue the insert commands add elements to */
+enum { INSERT_HEAD, INSERT_TAIL };
+
+/*
+ * Check that the n strings starting at the position of it are copies of
+ * strs, in reverse order if reversed is true, each in its own allocation.
+ * Every string is checked to be a distinct block holding the same characters
+ * as the string it copies.
+ */
+static bool check_inserted(q_iter_t it, char **strs, size_t n, bool reversed)
 {
     char *lasts = NULL;
-    char randstr_buf[MAX_RANDSTR_LEN];
+    for (size_t i = 0; i < n; i++, q_iter_next(&it)) {
+        char *s = strs[reversed ? n - 1 - i : i];
+        char *value = q_iter_valid(&it) ? q_iter_value(&it) : NULL;
+        if (!value) {
+            report(1, "ERROR: Failed to save copy of string in list");
+            return false;
+        }
+        if (value == s) {
+            report(1,
+                   "ERROR: Need to allocate and copy string for new "
+                   "list element");
+            return false;
+        }
+        if (strcmp(value, s)) {
+            report(1, "ERROR: Inserted value %s != expected value %s", value,
+                   s);
+            return false;
+        }
+        if (value == lasts) {
+            report(1,
+                   "ERROR: Need to allocate separate string for each "
+                   "list element");
+            return false;
+        }
+        lasts = value;
+    }
+    return true;
+}
+
+/* Number of strings handed to q_insert_*_bulk at once */
+#define INSERT_BATCH 1024
+
+static bool do_insert(int option, int argc, char *argv[])
+{
+    static char randstr_buf[INSERT_BATCH][MAX_RANDSTR_LEN];
+    char *strs[INSERT_BATCH];
     int reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
@@ -199,51 +450,65 @@ static bool do_insert_head(int argc, char *argv[])
         }
     }
 
-    if (!strcmp(inserts, "RAND")) {
+    if (!strcmp(inserts, "RAND"))
         need_rand = true;
-        inserts = randstr_buf;
-    }
 
     if (!q)
-        report(3, "Warning: Calling insert head on null queue");
+        report(3, "Warning: Calling insert %s on null queue",
+               option == INSERT_HEAD ? "head" : "tail");
     error_check();
 
     if (exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = q_insert_head(q, inserts);
-            if (rval) {
-                qcnt++;
-                if (!q->head->value) {
-                    report(1, "ERROR: Failed to save copy of string in list");
-                    ok = false;
-                } else if (r == 0 && inserts == q->head->value) {
-                    report(1,
-                           "ERROR: Need to allocate and copy string for new "
-                           "list element");
-                    ok = false;
-                    break;
-                } else if (r == 1 && lasts == q->head->value) {
-                    report(1,
-                           "ERROR: Need to allocate separate string for each "
-                           "list element");
-                    ok = false;
-                    break;
+        for (int r = 0; ok && r < reps;) {
+            size_t batch = reps - r < INSERT_BATCH ? reps - r : INSERT_BATCH;
+            for (size_t i = 0; i < batch; i++) {
+                if (need_rand) {
+                    fill_rand_string(randstr_buf[i], MAX_RANDSTR_LEN);
+                    strs[i] = randstr_buf[i];
+                } else {
+                    strs[i] = inserts;
                 }
-                lasts = q->head->value;
-            } else {
-                fail_count++;
-                if (fail_count < fail_limit)
-                    report(2, "Insertion of %s failed", inserts);
-                else {
-                    report(1,
-                           "ERROR: Insertion of %s failed (%d failures total)",
-                           inserts, fail_count);
-                    ok = false;
+            }
+
+            size_t done = 0;
+            while (ok && done < batch) {
+                size_t cnt;
+                q_iter_t it;
+                if (option == INSERT_HEAD) {
+                    cnt = q_insert_head_bulk(q, strs + done, batch - done);
+                    it = q_iter_begin(q);
+                } else {
+                    /* The new strings follow the current tail, if any */
+                    it = q_iter_last(q);
+                    bool empty = !q_iter_valid(&it);
+                    cnt = q_insert_tail_bulk(q, strs + done, batch - done);
+                    if (empty)
+                        it = q_iter_begin(q);
+                    else
+                        q_iter_next(&it);
+                }
+                qcnt += cnt;
+                ok = check_inserted(it, strs + done, cnt,
+                                    option == INSERT_HEAD);
+                done += cnt;
+
+                if (ok && done < batch) {
+                    /* Count the string that failed and move past it */
+                    fail_count++;
+                    if (fail_count < fail_limit)
+                        report(2, "Insertion of %s failed", strs[done]);
+                    else {
+                        report(1,
+                               "ERROR: Insertion of %s failed (%d failures "
+                               "total)",
+                               strs[done], fail_count);
+                        ok = false;
+                    }
+                    done++;
                 }
+                ok = ok && !error_check();
             }
-            ok = ok && !error_check();
+            r += batch;
         }
     }
     exception_cancel();
@@ -252,6 +517,11 @@ static bool do_insert_head(int argc, char *argv[])
     return ok;
 }
 
+static bool do_insert_head(int argc, char *argv[])
+{
+    return do_insert(INSERT_HEAD, argc, argv);
+}
+
 static bool do_insert_tail(int argc, char *argv[])
 {
     if (simulation) {
@@ -268,107 +538,127 @@ static bool do_insert_tail(int argc, char *argv[])
         return ok;
     }
 
-    char randstr_buf[MAX_RANDSTR_LEN];
-    int reps = 1;
-    bool ok = true, need_rand = false;
-    if (argc != 2 && argc != 3) {
-        report(1, "%s needs 1-2 arguments", argv[0]);
-        return false;
-    }
+    return do_insert(INSERT_TAIL, argc, argv);
+}
 
-    char *inserts = argv[1];
-    if (argc == 3) {
-        if (!get_int(argv[2], &reps)) {
-            report(1, "Invalid number of insertions '%s'", argv[2]);
-            return false;
-        }
-    }
+/*
+ * Allocate a buffer for strings removed into its first bufsize bytes,
+ * followed by *pad bytes of padding showing any overrun, and a terminator.
+ * In guarded mode, byte bufsize lies on a guard page instead, so that an
+ * overrun faults at once, and *pad is 0.  Free with free_removes.
+ */
+static char *alloc_removes(size_t bufsize, size_t *pad)
+{
+    char *removes = guard_sample > 0 ? test_malloc_guarded(bufsize) : NULL;
+    *pad = removes ? 0 : STRINGPAD;
+    if (!removes)
+        removes = malloc(bufsize + STRINGPAD + 1);
+    if (!removes)
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for removed strings");
+    return removes;
+}
 
-    if (!strcmp(inserts, "RAND")) {
-        need_rand = true;
-        inserts = randstr_buf;
-    }
+static void free_removes(char *removes, size_t pad)
+{
+    if (pad)
+        free(removes);
+    else
+        test_free(removes);
+}
 
-    if (!q)
-        report(3, "Warning: Calling insert tail on null queue");
-    error_check();
+/* Which element the remove commands take out of the queue */
+enum { REMOVE_HEAD, REMOVE_TAIL, REMOVE_AT };
 
-    if (exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = q_insert_tail(q, inserts);
-            if (rval) {
-                qcnt++;
-                if (!q->head->value) {
-                    report(1, "ERROR: Failed to save copy of string in list");
-                    ok = false;
-                }
-            } else {
-                fail_count++;
-                if (fail_count < fail_limit)
-                    report(2, "Insertion of %s failed", inserts);
-                else {
-                    report(1,
-                           "ERROR: Insertion of %s failed (%d failures total)",
-                           inserts, fail_count);
-                    ok = false;
-                }
-            }
-            ok = ok && !error_check();
-        }
-    }
-    exception_cancel();
-    show_queue(3);
-    return ok;
-}
+static const char *remove_names[] = {"remove head", "remove tail", "erase"};
 
-static bool do_remove_head(int argc, char *argv[])
+static bool do_remove(int option, int argc, char *argv[])
 {
-    if (argc != 1 && argc != 2) {
-        report(1, "%s needs 0-1 arguments", argv[0]);
+    /* erase takes the mark of the element before the expected value */
+    int nargs = option == REMOVE_AT ? 2 : 1;
+    if (argc != nargs && argc != nargs + 1) {
+        report(1, "%s needs %d-%d arguments", argv[0], nargs - 1, nargs);
         return false;
     }
 
-    char *removes = malloc(string_length + STRINGPAD + 1);
-    if (!removes) {
-        report(1,
-               "INTERNAL ERROR.  Could not allocate space for removed strings");
-        return false;
+#ifdef QUEUE_LIST
+    list_ele_t *target = NULL;
+    int m = 0;
+    if (option == REMOVE_AT) {
+        if (!get_int(argv[1], &m) || m < 0 || m >= NMARKS) {
+            report(1, "Invalid mark '%s'", argv[1]);
+            return false;
+        }
+        /*
+         * The marks of removed elements are dropped, so erase by one of
+         * them fails like any removal, rather than take whatever element
+         * has its space now
+         */
+        target = marks[m];
+        if (!target)
+            report(3, "Warning: Calling erase on unset mark %d", m);
+        /*
+         * Make sure the element is still in the queue, comparing addresses
+         * only, as a removed one is gone
+         */
+        list_ele_t *e = q && target ? q->head : NULL;
+        while (e && e != target)
+            e = e->next;
+        if (target && !e) {
+            report(1, "ERROR: Element of mark %d is not in queue", m);
+            return false;
+        }
     }
+#endif
+
+    size_t pad;
+    char *removes = alloc_removes(string_length + 1, &pad);
+    if (!removes)
+        return false;
 
     char *checks = malloc(string_length + 1);
     if (!checks) {
         report(1,
                "INTERNAL ERROR.  Could not allocate space for removed strings");
-        free(removes);
+        free_removes(removes, pad);
         return false;
     }
 
-    bool check = argc > 1;
+    bool check = argc > nargs;
     bool ok = true;
     if (check) {
-        strncpy(checks, argv[1], string_length + 1);
+        strncpy(checks, argv[nargs], string_length + 1);
         checks[string_length] = '\0';
     }
 
     removes[0] = '\0';
-    memset(removes + 1, 'X', string_length + STRINGPAD - 1);
-    removes[string_length + STRINGPAD] = '\0';
+    memset(removes + 1, 'X', string_length + pad - 1);
+    removes[string_length + pad] = '\0';
 
     if (!q)
-        report(3, "Warning: Calling remove head on null queue");
-    else if (!q->head)
-        report(3, "Warning: Calling remove head on empty queue");
+        report(3, "Warning: Calling %s on null queue", remove_names[option]);
+    else if (!q_peek_head(q))
+        report(3, "Warning: Calling %s on empty queue", remove_names[option]);
     error_check();
 
     bool rval = false;
-    if (exception_setup(true))
-        rval = q_remove_head(q, removes, string_length + 1);
+    if (exception_setup(true)) {
+        if (option == REMOVE_HEAD)
+            rval = q_remove_head(q, removes, string_length + 1);
+        else if (option == REMOVE_TAIL)
+            rval = q_remove_tail(q, removes, string_length + 1);
+#ifdef QUEUE_LIST
+        else
+            rval = q_erase(q, target, removes, string_length + 1);
+#endif
+    }
     exception_cancel();
 
+    if (rval)
+        drop_marks();
+
     if (rval) {
-        removes[string_length + STRINGPAD] = '\0';
+        removes[string_length + pad] = '\0';
         if (removes[0] == '\0') {
             report(1, "ERROR: Failed to store removed value");
             ok = false;
@@ -379,12 +669,13 @@ static bool do_remove_head(int argc, char *argv[])
          * If there's other character in padding, it's overflowed.
          */
         int i = string_length + 1;
-        while ((i < string_length + STRINGPAD) && (removes[i] == 'X'))
+        while ((i < string_length + pad) && (removes[i] == 'X'))
             i++;
-        if (i != string_length + STRINGPAD) {
+        if (i < string_length + pad) {
             report(1,
-                   "ERROR: copying of string in remove_head overflowed "
-                   "destination buffer.");
+                   "ERROR: copying of string in %s overflowed destination "
+                   "buffer.",
+                   remove_names[option]);
             ok = false;
         } else {
             report(2, "Removed %s from queue", removes);
@@ -409,47 +700,220 @@ static bool do_remove_head(int argc, char *argv[])
 
     show_queue(3);
 
-    free(removes);
+    free_removes(removes, pad);
     free(checks);
     return ok && !error_check();
 }
 
-static bool do_remove_head_quiet(int argc, char *argv[])
+static bool do_remove_head(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    return do_remove(REMOVE_HEAD, argc, argv);
+}
+
+static bool do_remove_tail(int argc, char *argv[])
+{
+    return do_remove(REMOVE_TAIL, argc, argv);
+}
+
+#ifdef QUEUE_LIST
+static bool do_mark(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+    int m, pos;
+    if (!get_int(argv[1], &m) || m < 0 || m >= NMARKS) {
+        report(1, "Invalid mark '%s'", argv[1]);
+        return false;
+    }
+    if (!get_int(argv[2], &pos) || pos < 0) {
+        report(1, "Invalid position '%s'", argv[2]);
+        return false;
+    }
+
+    list_ele_t *e = q ? q->head : NULL;
+    for (; e && pos > 0; pos--)
+        e = e->next;
+    if (!e) {
+        report(1, "No element at position %s", argv[2]);
+        return false;
+    }
+    marks[m] = e;
+    report(3, "Mark %d: %s", m, e->value);
+    return true;
+}
+
+static bool do_erase(int argc, char *argv[])
+{
+    return do_remove(REMOVE_AT, argc, argv);
+}
+#endif
+
+static bool do_remove_quiet(int option, int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
     }
 
+    int reps = 1;
+    if (argc == 2) {
+        if (!get_int(argv[1], &reps)) {
+            report(1, "Invalid number of removals '%s'", argv[1]);
+            return false;
+        }
+    }
+
     bool ok = true;
+    if (!q)
+        report(3, "Warning: Calling %s on null queue", remove_names[option]);
+    else if (!q_peek_head(q))
+        report(3, "Warning: Calling %s on empty queue", remove_names[option]);
+    error_check();
+
+    int removed = 0;
+    if (exception_setup(true)) {
+        for (int r = 0; ok && r < reps; r++) {
+            bool rval = option == REMOVE_HEAD ? q_remove_head(q, NULL, 0)
+                                              : q_remove_tail(q, NULL, 0);
+            if (rval) {
+                removed++;
+                qcnt--;
+            } else {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Removal failed");
+                else {
+                    report(1, "ERROR: Removal failed (%d failures total)",
+                           fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+
+    if (removed > 0) {
+        report(2, "Removed %d element(s) from queue", removed);
+        drop_marks();
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_remove_head_quiet(int argc, char *argv[])
+{
+    return do_remove_quiet(REMOVE_HEAD, argc, argv);
+}
+
+/* Space for the strings copied out by one call of q_remove_head_bulk */
+#define REMOVE_BUFSIZE 65536
+#define REMOVE_BATCH 4096
+
+static bool do_remove_head_bulk(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int reps;
+    if (!get_int(argv[1], &reps) || reps < 0) {
+        report(1, "Invalid number of removals '%s'", argv[1]);
+        return false;
+    }
+
+    size_t pad;
+    char *removes = alloc_removes(REMOVE_BUFSIZE, &pad);
+    if (!removes)
+        return false;
+    size_t *offsets = malloc(REMOVE_BATCH * sizeof(size_t));
+    if (!offsets) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for removed strings");
+        free_removes(removes, pad);
+        return false;
+    }
+
     if (!q)
         report(3, "Warning: Calling remove head on null queue");
-    else if (!q->head)
+    else if (!q_peek_head(q))
         report(3, "Warning: Calling remove head on empty queue");
     error_check();
 
-    bool rval = false;
-    if (exception_setup(true))
-        rval = q_remove_head(q, NULL, 0);
-    exception_cancel();
+    bool ok = true;
+    int removed = 0;
+    while (ok && removed < reps) {
+        size_t n = reps - removed < REMOVE_BATCH ? reps - removed : REMOVE_BATCH;
+        memset(removes, 'X', REMOVE_BUFSIZE + pad);
+
+        size_t cnt = 0;
+        if (exception_setup(true))
+            cnt = q_remove_head_bulk(q, n, removes, REMOVE_BUFSIZE, offsets);
+        exception_cancel();
+
+        if (cnt == 0) {
+            fail_count++;
+            if (fail_count < fail_limit) {
+                report(2, "Removal from queue failed");
+            } else {
+                report(1,
+                       "ERROR: Removal from queue failed (%d failures total)",
+                       fail_count);
+                ok = false;
+            }
+            break;
+        }
+        removed += cnt;
+        qcnt -= cnt;
+
+        /* The strings must be packed one after the other from the start */
+        size_t next = 0;
+        for (size_t i = 0; ok && i < cnt && next <= REMOVE_BUFSIZE; i++) {
+            if (offsets[i] != next) {
+                report(1, "ERROR: Removed strings are not stored back to back");
+                ok = false;
+            } else {
+                next += strnlen(removes + next, REMOVE_BUFSIZE - next) + 1;
+            }
+        }
 
-    if (rval) {
-        report(2, "Removed element from queue");
-        qcnt--;
-    } else {
-        fail_count++;
-        if (fail_count < fail_limit)
-            report(2, "Removal failed");
-        else {
-            report(1, "ERROR: Removal failed (%d failures total)", fail_count);
+        /*
+         * Check whether padding past the buffer is still initial value 'X'.
+         * If there's other character in padding, it's overflowed.
+         */
+        int i = REMOVE_BUFSIZE;
+        while ((i < REMOVE_BUFSIZE + pad) && (removes[i] == 'X'))
+            i++;
+        if (ok && (next > REMOVE_BUFSIZE || i < REMOVE_BUFSIZE + pad)) {
+            report(1,
+                   "ERROR: copying of strings in remove head bulk overflowed "
+                   "destination buffer.");
             ok = false;
         }
+        ok = ok && !error_check();
+    }
+
+    if (removed > 0) {
+        report(2, "Removed %d element(s) from queue", removed);
+        drop_marks();
     }
 
     show_queue(3);
+
+    free_removes(removes, pad);
+    free(offsets);
     return ok && !error_check();
 }
 
+static bool do_remove_tail_quiet(int argc, char *argv[])
+{
+    return do_remove_quiet(REMOVE_TAIL, argc, argv);
+}
+
 static bool do_reverse(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -534,11 +998,50 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Order of strings a and b for sorting with the flags of q_sort_ex */
+static inline int sort_order(const char *a, const char *b, int flags)
+{
+    int c = flags & Q_SORT_NOCASE ? str_casecmp(a, b) : str_cmp(a, b);
+    return flags & Q_SORT_DESC ? -c : c;
+}
+
+/* Flags of q_sort_ex for the order q_sort sorts in */
+static int sort_flags()
+{
+    return q_sort_nocase ? Q_SORT_NOCASE : 0;
+}
+
+/* Check that the first cnt elements are in the order given by flags */
+static bool check_sorted(int cnt, int flags)
+{
+    if (!q)
+        return true;
+    char *prev = NULL;
+    for (q_iter_t it = q_iter_begin(q); q_iter_valid(&it) && cnt--;
+         q_iter_next(&it)) {
+        char *cur = q_iter_value(&it);
+        if (prev && sort_order(prev, cur, flags) > 0) {
+            report(1, "ERROR: Not sorted in %s order",
+                   flags & Q_SORT_DESC ? "descending" : "ascending");
+            return false;
+        }
+        prev = cur;
+    }
+    return true;
+}
+
 bool do_sort(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
-        return false;
+    int flags = sort_flags();
+    for (int i = 1; i < argc; i++) {
+        int flag = !strcmp(argv[i], "desc")     ? Q_SORT_DESC
+                   : !strcmp(argv[i], "nocase") ? Q_SORT_NOCASE
+                                                : 0;
+        if (flag == 0) {
+            report(1, "Invalid sort order '%s'", argv[i]);
+            return false;
+        }
+        flags |= flag;
     }
 
     if (!q)
@@ -550,19 +1053,80 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
+#ifdef QUEUE_LIST
+    /* Whatever space the sort needs is allocated ahead, see q_sort_prepare */
+    if (exception_setup(true))
+        q_sort_prepare(q);
+    exception_cancel();
+#endif
+
     set_noallocate_mode(true);
     if (exception_setup(true))
-        q_sort(q);
+        q_sort_ex(q, flags);
     exception_cancel();
     set_noallocate_mode(false);
 
-    bool ok = true;
-    if (q) {
-        for (list_ele_t *e = q->head; e && --cnt; e = e->next) {
-            /* Ensure each element in ascending order */
-            /* FIXME: add an option to specify sorting order */
-            if (strcasecmp(e->value, e->next->value) > 0) {
-                report(1, "ERROR: Not sorted in ascending order");
+#ifdef QUEUE_LIST
+    if (exception_setup(true))
+        q_sort_finish(q);
+    exception_cancel();
+#endif
+
+    bool ok = check_sorted(cnt, flags);
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+bool do_psort(int argc, char *argv[])
+{
+    int k;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &k) || k < 0) {
+        report(1, "Invalid number of elements '%s'", argv[1]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling psort on null queue");
+    error_check();
+
+    int cnt = q_size(q);
+    if (k > cnt)
+        k = cnt;
+
+#ifdef QUEUE_LIST
+    if (exception_setup(true))
+        q_sort_prepare(q);
+    exception_cancel();
+#endif
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_sort_partial(q, k);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+#ifdef QUEUE_LIST
+    if (exception_setup(true))
+        q_sort_finish(q);
+    exception_cancel();
+#endif
+
+    bool ok = check_sorted(k, sort_flags());
+
+    /* None of the other elements may come before the k-th one */
+    if (ok && q && k > 0) {
+        q_iter_t it = q_iter_begin(q);
+        for (int i = 1; i < k; i++)
+            q_iter_next(&it);
+        char *kth = q_iter_value(&it);
+        for (q_iter_next(&it); q_iter_valid(&it); q_iter_next(&it)) {
+            if (sort_order(q_iter_value(&it), kth, sort_flags()) < 0) {
+                report(1, "ERROR: Not the %d smallest elements at head", k);
                 ok = false;
                 break;
             }
@@ -573,6 +1137,91 @@ bool do_sort(int argc, char *argv[])
     return ok && !error_check();
 }
 
+bool do_esort(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    const char *dir = argc == 2 ? argv[1] : getenv("TMPDIR");
+    if (dir == NULL)
+        dir = "/tmp";
+
+    if (!q)
+        report(3, "Warning: Calling esort on null queue");
+    error_check();
+
+    int cnt = q_size(q);
+    bool ok = true;
+    if (exception_setup(true))
+        ok = q_sort_external(q, dir, sort_budget) || !q;
+    exception_cancel();
+    if (!ok)
+        report(1, "ERROR: Could not sort queue in directory %s", dir);
+
+    /* All the strings must be back, if only to keep track of them */
+    if (q_size(q) != cnt) {
+        report(1, "ERROR: Queue has %d elements after esort, expected %d",
+               q_size(q), cnt);
+        qcnt = q_size(q);
+        ok = false;
+    }
+    ok = ok && check_sorted(cnt, sort_flags());
+
+    /* The elements were removed and inserted anew on the way */
+    drop_marks();
+    show_queue(3);
+    return ok && !error_check();
+}
+
+bool do_dedup(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling dedup on null queue");
+    error_check();
+
+    int removed = 0;
+    if (exception_setup(true))
+        removed = q_dedup(q);
+    exception_cancel();
+
+    bool ok = true;
+    if (removed < 0 || (size_t) removed > qcnt) {
+        report(1, "ERROR: Removed %d elements out of %d", removed,
+               (int) qcnt);
+        removed = qcnt;
+        ok = false;
+    }
+    qcnt -= removed;
+    if (q_size(q) != qcnt) {
+        report(1, "ERROR: Queue has %d elements after dedup, expected %d",
+               q_size(q), (int) qcnt);
+        qcnt = q_size(q);
+        ok = false;
+    }
+
+    /* No element may equal the one before it anymore */
+    char *prev = NULL;
+    for (q_iter_t it = q_iter_begin(q); ok && q_iter_valid(&it);
+         q_iter_next(&it)) {
+        char *cur = q_iter_value(&it);
+        if (prev && sort_order(prev, cur, sort_flags()) == 0) {
+            report(1, "ERROR: Duplicate %s left in queue", cur);
+            ok = false;
+        }
+        prev = cur;
+    }
+
+    drop_marks();
+    show_queue(3);
+    return ok && !error_check();
+}
+
 static bool show_queue(int vlevel)
 {
     bool ok = true;
@@ -586,12 +1235,13 @@ static bool show_queue(int vlevel)
     }
 
     report_noreturn(vlevel, "q = [");
-    list_ele_t *e = q->head;
+    q_iter_t it = q_iter_begin(q);
     if (exception_setup(true)) {
-        while (ok && e && cnt < qcnt) {
+        while (ok && q_iter_valid(&it) && cnt < qcnt) {
             if (cnt < big_queue_size)
-                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
-            e = e->next;
+                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s",
+                                q_iter_value(&it));
+            q_iter_next(&it);
             cnt++;
             ok = ok && !error_check();
         }
@@ -603,7 +1253,7 @@ static bool show_queue(int vlevel)
         return false;
     }
 
-    if (!e) {
+    if (!q_iter_valid(&it)) {
         if (cnt <= big_queue_size)
             report(vlevel, "]");
         else
@@ -629,12 +1279,385 @@ static bool do_show(int argc, char *argv[])
     return show_queue(0);
 }
 
+static bool do_heapprof(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes at most one argument", argv[0]);
+        return false;
+    }
+
+    if (!heap_profile)
+        report(1, "Warning: Heap profiling is off, see option profile");
+    size_t blocks = heap_profile_show();
+    size_t allocated = allocation_check();
+    if (blocks > allocated) {
+        report(1, "ERROR: Profiled %zu blocks, but only %zu are allocated",
+               blocks, allocated);
+        return false;
+    }
+    if (blocks < allocated)
+        report(1, "%zu blocks allocated while not profiling are not shown",
+               allocated - blocks);
+
+    if (argc == 2 && !heap_profile_dump(argv[1])) {
+        report(1, "ERROR: Could not write heap profile to '%s'", argv[1]);
+        return false;
+    }
+    return true;
+}
+
+/* Most threads the stress command runs */
+#define STRESS_THREADS_MAX 64
+
+typedef struct {
+    queue_t *q;    /* Queue operated on */
+    int ops;       /* Number of random operations */
+    bool last;     /* Whether to free q once done */
+    unsigned seed; /* Of rand_r, rand not being reentrant */
+} stress_task_t;
+
+/* Make random operations on the queue of a task */
+static void *stress_task(void *arg)
+{
+    stress_task_t *t = arg;
+    char buf[MAX_RANDSTR_LEN];
+    for (int i = 0; i < t->ops; i++) {
+        /* As many insertions as removals, so that the queue stays short */
+        int op = rand_r(&t->seed) % 16;
+        if (op < 7) {
+            int len = MIN_RANDSTR_LEN +
+                      rand_r(&t->seed) % (MAX_RANDSTR_LEN - MIN_RANDSTR_LEN);
+            for (int n = 0; n < len; n++)
+                buf[n] = charset[rand_r(&t->seed) % (sizeof charset - 1)];
+            buf[len] = '\0';
+            if (op < 4)
+                q_insert_head(t->q, buf);
+            else
+                q_insert_tail(t->q, buf);
+        } else if (op < 14) {
+            q_remove_head(t->q, op < 12 ? buf : NULL, sizeof(buf));
+        } else if (op < 15) {
+            q_reverse(t->q);
+        } else {
+            q_sort(t->q);
+        }
+    }
+    q_sort(t->q);
+    if (t->last)
+        q_free(t->q);
+    return NULL;
+}
+
+/* Run the n tasks each in a thread, or in this one should a thread not start */
+static void stress_run(stress_task_t *tasks, int n)
+{
+    pthread_t threads[STRESS_THREADS_MAX];
+    bool started[STRESS_THREADS_MAX];
+    for (int i = 0; i < n; i++)
+        started[i] =
+            pthread_create(&threads[i], NULL, stress_task, &tasks[i]) == 0;
+    for (int i = 0; i < n; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            stress_task(&tasks[i]);
+    }
+}
+
+/*
+ * Each thread operates on a queue of its own, then on the one of the next
+ * thread, which it frees: most blocks are freed by another thread than the
+ * one that allocated them, while that one allocates others.  The harness
+ * then reports any corruption it found, and the blocks left allocated.
+ *
+ * Not under the time limit: it would interrupt this thread waiting for the
+ * others, which would go on using the queues.  They block SIGALRM, so that
+ * a time limit of a sort they make in parallel is this thread's to enforce.
+ */
+static bool do_stress(int argc, char *argv[])
+{
+    int nthreads = 4, ops = 10000;
+    if (argc > 3) {
+        report(1, "%s takes at most two arguments", argv[0]);
+        return false;
+    }
+    if (argc > 1 && (!get_int(argv[1], &nthreads) || nthreads < 1 ||
+                     nthreads > STRESS_THREADS_MAX)) {
+        report(1, "Invalid number of threads '%s' (1 to %d)", argv[1],
+               STRESS_THREADS_MAX);
+        return false;
+    }
+    if (argc > 2 && (!get_int(argv[2], &ops) || ops < 0)) {
+        report(1, "Invalid number of operations '%s'", argv[2]);
+        return false;
+    }
+
+    size_t before = allocation_check();
+    error_check();
+
+    sigset_t alarm, saved;
+    sigemptyset(&alarm);
+    sigaddset(&alarm, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alarm, &saved);
+
+    stress_task_t tasks[STRESS_THREADS_MAX];
+    for (int i = 0; i < nthreads; i++)
+        tasks[i] = (stress_task_t){q_new(), ops, false, (unsigned) rand()};
+    stress_run(tasks, nthreads);
+    queue_t *first = tasks[0].q;
+    for (int i = 0; i < nthreads; i++) {
+        tasks[i].q = i + 1 < nthreads ? tasks[i + 1].q : first;
+        tasks[i].last = true;
+    }
+    stress_run(tasks, nthreads);
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    bool ok = !error_check();
+    size_t after = allocation_check();
+    if (after != before) {
+        report(1, "ERROR: Freed the queues of the threads, but %zd blocks are "
+               "still allocated",
+               (ssize_t) (after - before));
+        ok = false;
+    }
+    return ok;
+}
+
+/* Get the number of a queue, other than the current one if !current */
+static bool get_queue_num(char *arg, int *n, bool current)
+{
+    if (!get_int(arg, n) || *n < 0 || *n >= NQUEUES) {
+        report(1, "Invalid queue number '%s' (0 to %d)", arg, NQUEUES - 1);
+        return false;
+    }
+    if (!current && *n == qcur) {
+        report(1, "Queue %d is the current one", *n);
+        return false;
+    }
+    return true;
+}
+
+static bool do_switch(int argc, char *argv[])
+{
+    int n;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_queue_num(argv[1], &n, true))
+        return false;
+
+    count_pool_blocks();
+    queues[qcur].q = q;
+    queues[qcur].cnt = qcnt;
+    qcur = n;
+    q = queues[n].q;
+    qcnt = queues[n].cnt;
+    report(2, "Switched to queue %d", n);
+
+    show_queue(3);
+    return true;
+}
+
+static bool do_splice(int argc, char *argv[])
+{
+    int n;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_queue_num(argv[1], &n, false))
+        return false;
+
+    if (!q)
+        report(3, "Warning: Calling splice on null queue");
+    if (!queues[n].q)
+        report(3, "Warning: Splicing null queue %d", n);
+    error_check();
+
+    bool ok = true, rval = false;
+    if (exception_setup(true))
+        rval = q_splice_tail(q, queues[n].q);
+    exception_cancel();
+    if (q && queues[n].q) {
+        count_pool_blocks();
+        join_pool(n);
+    }
+
+    if (rval) {
+        qcnt += queues[n].cnt;
+        queues[n].cnt = 0;
+        if (q_size(queues[n].q) != 0) {
+            report(1, "ERROR: Queue %d not empty after splice", n);
+            ok = false;
+        }
+    } else if (q && queues[n].q) {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Splice failed");
+        else {
+            report(1, "ERROR: Splice failed (%d failures total)", fail_count);
+            ok = false;
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_split(int argc, char *argv[])
+{
+    int k, n;
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &k) || k < 0) {
+        report(1, "Invalid split position '%s'", argv[1]);
+        return false;
+    }
+    if (!get_queue_num(argv[2], &n, false))
+        return false;
+    if (queues[n].q) {
+        report(1, "Queue %d is in use, free it first", n);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling split on null queue");
+    error_check();
+
+    queue_t *r = NULL;
+    if (exception_setup(true))
+        r = q_split(q, k);
+    exception_cancel();
+
+    bool ok = true;
+    if (r) {
+        count_pool_blocks();
+        join_pool(n);
+        size_t rcnt = qcnt > (size_t) k ? qcnt - k : 0;
+        queues[n].q = r;
+        queues[n].cnt = rcnt;
+        qcnt -= rcnt;
+        if (q_size(q) != qcnt || q_size(r) != rcnt) {
+            report(1,
+                   "ERROR: Split into queues of %d and %d elements, but "
+                   "correct sizes are %d and %d",
+                   q_size(q), q_size(r), (int) qcnt, (int) rcnt);
+            ok = false;
+        }
+    } else if (q) {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Split failed");
+        else {
+            report(1, "ERROR: Split failed (%d failures total)", fail_count);
+            ok = false;
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_merge(int argc, char *argv[])
+{
+    if (argc < 2) {
+        report(1, "%s needs at least 1 argument", argv[0]);
+        return false;
+    }
+
+    /* The current queue comes first, then the others in the order given */
+    queue_t *qs[NQUEUES];
+    int nums[NQUEUES];
+    bool seen[NQUEUES] = {false};
+    int k = argc;
+    if (k > NQUEUES) {
+        report(1, "%s takes at most %d arguments", argv[0], NQUEUES - 1);
+        return false;
+    }
+    qs[0] = q;
+    for (int i = 1; i < k; i++) {
+        if (!get_queue_num(argv[i], &nums[i], false))
+            return false;
+        if (seen[nums[i]]) {
+            report(1, "Queue %d given twice", nums[i]);
+            return false;
+        }
+        seen[nums[i]] = true;
+        qs[i] = queues[nums[i]].q;
+    }
+
+    bool present = true;
+    for (int i = 0; i < k; i++) {
+        if (qs[i])
+            continue;
+        present = false;
+        if (i == 0)
+            report(3, "Warning: Calling merge on null queue");
+        else
+            report(3, "Warning: Merging null queue %d", nums[i]);
+    }
+    error_check();
+
+    bool ok = true, rval = false;
+    if (exception_setup(true))
+        rval = q_merge_k(qs, k);
+    exception_cancel();
+    count_pool_blocks();
+    for (int i = 1; i < k; i++)
+        if (qs[i])
+            join_pool(nums[i]);
+
+    if (rval) {
+        for (int i = 1; i < k; i++) {
+            qcnt += queues[nums[i]].cnt;
+            queues[nums[i]].cnt = 0;
+            if (q_size(qs[i]) != 0) {
+                report(1, "ERROR: Queue %d not empty after merge", nums[i]);
+                ok = false;
+            }
+        }
+        if (q_size(q) != qcnt) {
+            report(1, "ERROR: Merged queue has %d elements, expected %d",
+                   q_size(q), (int) qcnt);
+            ok = false;
+        }
+        ok = ok && check_sorted(qcnt, sort_flags());
+    } else if (present) {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Merge failed");
+        else {
+            report(1, "ERROR: Merge failed (%d failures total)", fail_count);
+            ok = false;
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
 /* Signal handlers */
-static void sigsegvhandler(int sig)
+static void sigsegvhandler(int sig, siginfo_t *info, void *context)
 {
-    report(1,
-           "Segmentation fault occurred.  You dereferenced a NULL or invalid "
-           "pointer");
+    char desc[MAX_CHAR];
+    /*
+     * The fault may be an access past the end of a guarded block.  Neither
+     * guard_overrun nor report is async-signal-safe, which is acceptable
+     * only because abort follows.
+     */
+    if (guard_overrun(info->si_addr, desc, sizeof(desc)))
+        report(1,
+               "Segmentation fault occurred.  You accessed memory past the "
+               "end of a block.  %s",
+               desc);
+    else
+        report(1,
+               "Segmentation fault occurred.  You dereferenced a NULL or "
+               "invalid pointer");
     /* Raising a SIGABRT signal to produce a core dump for debugging. */
     abort();
 }
@@ -650,20 +1673,25 @@ static void queue_init()
 {
     fail_count = 0;
     q = NULL;
-    signal(SIGSEGV, sigsegvhandler);
+    for (int i = 0; i < NQUEUES; i++)
+        queues[i].pool = i;
+    struct sigaction sa = {.sa_sigaction = sigsegvhandler,
+                           .sa_flags = SA_SIGINFO};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
     signal(SIGALRM, sigalrmhandler);
 }
 
 static bool queue_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (qcnt > big_queue_size)
-        set_cautious_mode(false);
-
-    if (exception_setup(true))
-        q_free(q);
-    exception_cancel();
-    set_cautious_mode(true);
+    queues[qcur].q = q;
+    queues[qcur].cnt = qcnt;
+    for (int i = 0; i < NQUEUES; i++) {
+        if (exception_setup(true))
+            q_free(queues[i].q);
+        exception_cancel();
+    }
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
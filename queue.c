@@ -1,9 +1,243 @@
+#include <endian.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "harness.h"
 #include "queue.h"
+#include "strcmp_simd.h"
+
+/*
+ * Elements are not allocated one by one.  Every queue owns an arena that
+ * carves elements, together with their inline strings, out of large chunks.
+ * The chunks themselves come from malloc, so the test harness still accounts
+ * for every byte and reports a chunk that was never released as a leak.
+ *
+ * Removed elements are kept on per-size free lists for reuse, and q_free
+ * returns the whole queue by releasing its chunks rather than walking the
+ * list.  Elements too large for any size class get a chunk of their own,
+ * which is released as soon as the element is removed.
+ *
+ * Elements move between queues by q_splice_tail and q_split, so an arena
+ * may hold the elements of several queues.  Those queues are linked in a
+ * circle through their sibling pointers, and only the last of them to be
+ * freed releases the arena.  Splicing queues with different arenas merges
+ * one arena into the other.
+ */
+
+/* Granularity of element sizes, and alignment of every element */
+#define ARENA_ALIGN 8
+
+/* Number of size classes; larger elements get a chunk of their own */
+#define ARENA_CLASSES 32
+
+/* Usable bytes of the first chunk, and limit of the geometric growth */
+#define CHUNK_MIN 4096
+#define CHUNK_MAX (4 << 20)
+
+/* Chunks are kept in a doubly-linked list, so that one can be unlinked */
+typedef struct CHUNK {
+    struct CHUNK *next, *prev;
+    char data[];
+} chunk_t;
+
+/*
+ * The arena itself lives at the start of its first chunk, which stays last
+ * in the list of chunks since new chunks are linked in front.
+ */
+typedef struct ARENA {
+    chunk_t *chunks;   /* Chunks allocated so far, this one last */
+    char *cur, *end;   /* Unused part of the newest chunk */
+    size_t chunk_size; /* Usable bytes of the next chunk */
+    list_ele_t *free_list[ARENA_CLASSES + 1]; /* Removed elements by class */
+    list_ele_t *free_tail[ARENA_CLASSES + 1]; /* Last of each free list */
+    char first[];      /* Rest of the first chunk */
+} arena_t;
+
+static inline chunk_t *arena_chunk(arena_t *a)
+{
+    return (chunk_t *) ((char *) a - offsetof(chunk_t, data));
+}
+
+static arena_t *arena_new()
+{
+    chunk_t *chunk = malloc(sizeof(chunk_t) + sizeof(arena_t) + CHUNK_MIN);
+    if (chunk == NULL)
+        return NULL;
+    chunk->next = chunk->prev = NULL;
+    arena_t *a = (arena_t *) chunk->data;
+    a->chunks = chunk;
+    a->cur = a->first;
+    a->end = a->first + CHUNK_MIN;
+    a->chunk_size = CHUNK_MIN * 2;
+    for (int c = 0; c <= ARENA_CLASSES; c++)
+        a->free_list[c] = NULL;
+    return a;
+}
+
+/* Release every chunk, the one holding the arena itself included */
+static void arena_free(arena_t *a)
+{
+    chunk_t *c = a->chunks;
+    while (c) {
+        chunk_t *target = c;
+        c = c->next;
+        free(target);
+    }
+}
+
+/*
+ * Hand everything allocated from arena b over to arena a, after which b is
+ * no longer used.  The chunks of b, ending with the one holding b, go in
+ * front of those of a, so the chunk holding a stays last.
+ */
+static void arena_merge(arena_t *a, arena_t *b)
+{
+    chunk_t *last = arena_chunk(b);
+    last->next = a->chunks;
+    a->chunks->prev = last;
+    a->chunks = b->chunks;
+    for (int c = 0; c <= ARENA_CLASSES; c++) {
+        if (b->free_list[c] == NULL)
+            continue;
+        b->free_tail[c]->next = a->free_list[c];
+        if (a->free_list[c] == NULL)
+            a->free_tail[c] = b->free_tail[c];
+        a->free_list[c] = b->free_list[c];
+    }
+    if (a->chunk_size < b->chunk_size)
+        a->chunk_size = b->chunk_size;
+}
+
+/* Size class of an element holding a string of len bytes (without '\0') */
+static inline size_t arena_class(size_t len)
+{
+    return (offsetof(list_ele_t, str) + len + ARENA_ALIGN) / ARENA_ALIGN;
+}
+
+static inline void chunk_link(arena_t *a, chunk_t *c)
+{
+    c->prev = NULL;
+    c->next = a->chunks;
+    if (a->chunks)
+        a->chunks->prev = c;
+    a->chunks = c;
+}
+
+/*
+ * Get space for an element of size class cls.
+ * Return NULL if could not allocate space.
+ */
+static list_ele_t *arena_alloc(arena_t *a, size_t cls)
+{
+    size_t bytes = cls * ARENA_ALIGN;
+    if (cls > ARENA_CLASSES) {
+        chunk_t *c = malloc(sizeof(chunk_t) + bytes);
+        if (c == NULL)
+            return NULL;
+        chunk_link(a, c);
+        return (list_ele_t *) c->data;
+    }
+
+    list_ele_t *e = a->free_list[cls];
+    if (e != NULL) {
+        a->free_list[cls] = e->next;
+        return e;
+    }
+
+    if ((size_t) (a->end - a->cur) < bytes) {
+        chunk_t *c = malloc(sizeof(chunk_t) + a->chunk_size);
+        if (c == NULL)
+            return NULL;
+        chunk_link(a, c);
+        a->cur = c->data;
+        a->end = c->data + a->chunk_size;
+        if (a->chunk_size < CHUNK_MAX)
+            a->chunk_size *= 2;
+    }
+    e = (list_ele_t *) a->cur;
+    a->cur += bytes;
+    return e;
+}
+
+/* Give back the space of an element holding a string of len bytes */
+static void arena_release(arena_t *a, list_ele_t *e, size_t len)
+{
+    size_t cls = arena_class(len);
+    if (cls > ARENA_CLASSES) {
+        chunk_t *c = (chunk_t *) ((char *) e - offsetof(chunk_t, data));
+        if (c->prev)
+            c->prev->next = c->next;
+        else
+            a->chunks = c->next;
+        if (c->next)
+            c->next->prev = c->prev;
+        free(c);
+        return;
+    }
+    if (a->free_list[cls] == NULL)
+        a->free_tail[cls] = e;
+    e->next = a->free_list[cls];
+    a->free_list[cls] = e;
+}
+
+/*
+ * Give back the space of the chain of elements from first to last, which
+ * all hold strings of len bytes
+ */
+static void arena_release_chain(arena_t *a,
+                                list_ele_t *first,
+                                list_ele_t *last,
+                                size_t len)
+{
+    size_t cls = arena_class(len);
+    if (cls > ARENA_CLASSES) {
+        for (list_ele_t *e = first, *next; e != last; e = next) {
+            next = e->next;
+            arena_release(a, e, len);
+        }
+        arena_release(a, last, len);
+        return;
+    }
+    /* Elements of one class, the chain goes to the free list as it is */
+    if (a->free_list[cls] == NULL)
+        a->free_tail[cls] = last;
+    last->next = a->free_list[cls];
+    a->free_list[cls] = first;
+}
+
+/* Length of the string of e */
+static inline size_t ele_len(list_ele_t *e)
+{
+#ifdef QUEUE_SORT_KEY
+    return e->len;
+#else
+    return strlen(e->value);
+#endif
+}
+
+/*
+ * The first 8 bytes of s, padded with zeros past its end and packed most
+ * significant first
+ */
+static inline uint64_t str_word(const char *s)
+{
+    uint64_t word = 0;
+    memcpy(&word, s, strnlen(s, 8));
+    return be64toh(word);
+}
+
+/* Sort key of e, see list_ele_t */
+static inline uint64_t ele_key(list_ele_t *e)
+{
+#ifdef QUEUE_SORT_KEY
+    return e->key;
+#else
+    return str_word(e->value);
+#endif
+}
 
 /*
  * Create empty queue.
@@ -12,12 +246,20 @@
 queue_t *q_new()
 {
     queue_t *q = malloc(sizeof(queue_t));
-    if (q != NULL) {
-        q->head = NULL;
-        q->tail = NULL;
-        q->size = 0;
+    if (q == NULL)
+        return NULL;
+    q->arena = arena_new();
+    if (q->arena == NULL) {
+        free(q);
+        return NULL;
     }
-    return q; /* If malloc returned NULL, this function returns NULL */
+    q->head = NULL;
+    q->tail = NULL;
+    q->size = 0;
+    q->sibling = q;
+    q->sort_buf = NULL;
+    q->sort_cap = 0;
+    return q;
 }
 
 /* Free all storage used by queue */
@@ -26,31 +268,46 @@ void q_free(queue_t *q)
     /* No effect if q is NULL */
     if (q == NULL)
         return;
-    /* Free the list elements and the strings */
-    while (q->head) {
-        list_ele_t *target = q->head;
-        q->head = target->next;
-        free(target->value);
-        free(target);
+    if (q->sibling == q) {
+        /* The elements live in the chunks of the arena, release them at once */
+        arena_free(q->arena);
+    } else {
+        /* Other queues still use the arena, give the elements back to it */
+        list_ele_t *e = q->head;
+        while (e) {
+            list_ele_t *target = e;
+            e = e->next;
+            arena_release(q->arena, target, ele_len(target));
+        }
+        queue_t *prev = q->sibling;
+        while (prev->sibling != q)
+            prev = prev->sibling;
+        prev->sibling = q->sibling;
     }
+    free(q->sort_buf);
     /* Free queue structure */
     free(q);
 }
 
-static inline bool ele_new(char *s, list_ele_t **newh, char **value)
+/*
+ * Allocate an element together with the space for its string, copy the
+ * string into the inline storage and fill in its sort key, if cached.
+ * Return NULL if could not allocate space.
+ */
+static inline list_ele_t *ele_new(queue_t *q, char *s)
 {
-    *newh = malloc(sizeof(list_ele_t));
-    *value = strdup(s); /* Allocate space for the string and copy it */
-
-    /* If either call to malloc returns NULL */
-    if (*newh == NULL || *value == NULL) {
-        if (*newh)
-            free(*newh);
-        if (*value)
-            free(*value);
-        return false;
-    }
-    return true;
+    size_t len = strlen(s);
+    list_ele_t *newh = arena_alloc(q->arena, arena_class(len));
+    if (newh == NULL)
+        return NULL;
+    newh->value = memcpy(newh->str, s, len + 1);
+#ifdef QUEUE_SORT_KEY
+    newh->len = len;
+    uint64_t key = 0;
+    memcpy(&key, s, len < 8 ? len : 8);
+    newh->key = be64toh(key);
+#endif
+    return newh;
 }
 
 /*
@@ -64,17 +321,18 @@ bool q_insert_head(queue_t *q, char *s)
 {
     if (q == NULL)
         return false;
-    list_ele_t *newh;
-    char *value;
-    if (!ele_new(s, &newh, &value))
+    list_ele_t *newh = ele_new(q, s);
+    if (newh == NULL)
         return false;
 
     /* set up the element and insert at the head of the queue*/
-    newh->value = value;
     newh->next = q->head;
-    q->head = newh;
-    if (q->tail == NULL)
+    newh->prev = NULL;
+    if (q->head != NULL)
+        q->head->prev = newh;
+    else
         q->tail = newh;
+    q->head = newh;
     q->size++;
     return true;
 }
@@ -90,14 +348,13 @@ bool q_insert_tail(queue_t *q, char *s)
 {
     if (q == NULL)
         return false;
-    list_ele_t *newh;
-    char *value;
-    if (!ele_new(s, &newh, &value))
+    list_ele_t *newh = ele_new(q, s);
+    if (newh == NULL)
         return false;
 
     /* set up the element and insert at the tail of the queue */
-    newh->value = value;
     newh->next = NULL;
+    newh->prev = q->tail;
     if (q->tail != NULL)
         q->tail->next = newh;
     else
@@ -107,6 +364,106 @@ bool q_insert_tail(queue_t *q, char *s)
     return true;
 }
 
+/*
+ * Attempt to insert the n strings of array strs at head of queue, with the
+ * same result as calling q_insert_head on each of them in turn.
+ * Return the number of strings inserted.
+ */
+size_t q_insert_head_bulk(queue_t *q, char **strs, size_t n)
+{
+    if (q == NULL || n == 0)
+        return 0;
+
+    /* Build a chain of the new elements, then link it in front at once */
+    list_ele_t *first = NULL, *last = NULL;
+    size_t cnt = 0;
+    for (; cnt < n; cnt++) {
+        list_ele_t *newh = ele_new(q, strs[cnt]);
+        if (newh == NULL)
+            break;
+        newh->next = first;
+        newh->prev = NULL;
+        if (first != NULL)
+            first->prev = newh;
+        else
+            last = newh;
+        first = newh;
+    }
+    if (cnt == 0)
+        return 0;
+
+    last->next = q->head;
+    if (q->head != NULL)
+        q->head->prev = last;
+    else
+        q->tail = last;
+    q->head = first;
+    q->size += cnt;
+    return cnt;
+}
+
+/*
+ * Attempt to insert the n strings of array strs at tail of queue, with the
+ * same result as calling q_insert_tail on each of them in turn.
+ * Return the number of strings inserted.
+ */
+size_t q_insert_tail_bulk(queue_t *q, char **strs, size_t n)
+{
+    if (q == NULL || n == 0)
+        return 0;
+
+    /* Build a chain of the new elements, then link it behind at once */
+    list_ele_t *first = NULL, *last = NULL;
+    size_t cnt = 0;
+    for (; cnt < n; cnt++) {
+        list_ele_t *newh = ele_new(q, strs[cnt]);
+        if (newh == NULL)
+            break;
+        newh->next = NULL;
+        newh->prev = last;
+        if (last != NULL)
+            last->next = newh;
+        else
+            first = newh;
+        last = newh;
+    }
+    if (cnt == 0)
+        return 0;
+
+    first->prev = q->tail;
+    if (q->tail != NULL)
+        q->tail->next = first;
+    else
+        q->head = first;
+    q->tail = last;
+    q->size += cnt;
+    return cnt;
+}
+
+/*
+ * Unlink element e from queue q and free it, copying its string to *sp
+ * first if sp is non-NULL.
+ */
+static void ele_remove(queue_t *q, list_ele_t *e, char *sp, size_t bufsize)
+{
+    size_t len = ele_len(e);
+    if (sp != NULL) {
+        size_t length = (bufsize - 1 >= len) ? len : bufsize - 1;
+        strncpy(sp, e->value, length);
+        *(sp + length) = '\0';
+    }
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        q->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        q->tail = e->prev;
+    arena_release(q->arena, e, len);
+    q->size--;
+}
+
 /*
  * Attempt to remove element from head of queue.
  * Return true if successful.
@@ -119,20 +476,79 @@ bool q_remove_head(queue_t *q, char *sp, size_t bufsize)
 {
     if (q == NULL || q->head == NULL)
         return false;
-    if (sp != NULL) {
-        int length = strlen(q->head->value);
-        length = (bufsize - 1 >= length) ? length : bufsize - 1;
-        strncpy(sp, q->head->value, length);
-        *(sp + length) = '\0';
+    ele_remove(q, q->head, sp, bufsize);
+    return true;
+}
+
+/*
+ * Attempt to remove up to n elements from head of queue, copying their
+ * strings back to back into buf if it is non-NULL.
+ * Return the number of elements removed.
+ */
+size_t q_remove_head_bulk(queue_t *q,
+                          size_t n,
+                          char *buf,
+                          size_t bufsize,
+                          size_t *offsets)
+{
+    if (q == NULL)
+        return 0;
+
+    list_ele_t *e = q->head;
+    size_t cnt = 0, used = 0;
+    for (; e != NULL && cnt < n; cnt++) {
+        size_t len = ele_len(e);
+        if (buf != NULL) {
+            size_t length = len;
+            if (used + length + 1 > bufsize) {
+                if (cnt > 0 || bufsize == 0)
+                    break;
+                length = bufsize - 1;
+            }
+            memcpy(buf + used, e->value, length);
+            buf[used + length] = '\0';
+            if (offsets != NULL)
+                offsets[cnt] = used;
+            used += length + 1;
+        }
+        list_ele_t *target = e;
+        e = e->next;
+        arena_release(q->arena, target, len);
     }
-    list_ele_t *target = q->head;
-    if (q->head == q->tail)
-        q->head = q->tail = NULL;
+
+    /* Unlink the whole run of removed elements at once */
+    q->head = e;
+    if (e != NULL)
+        e->prev = NULL;
     else
-        q->head = q->head->next;
-    free(target->value);
-    free(target);
-    q->size--;
+        q->tail = NULL;
+    q->size -= cnt;
+    return cnt;
+}
+
+/*
+ * Attempt to remove element from tail of queue.
+ * Other than the end it removes from, same as q_remove_head.
+ */
+bool q_remove_tail(queue_t *q, char *sp, size_t bufsize)
+{
+    if (q == NULL || q->tail == NULL)
+        return false;
+    ele_remove(q, q->tail, sp, bufsize);
+    return true;
+}
+
+/*
+ * Attempt to remove element e, given by its handle, from queue q.
+ * Return true if successful.
+ * Return false if q or e is NULL.  Element e must belong to queue q.
+ * If sp is non-NULL, copy the removed string to *sp as q_remove_head does.
+ */
+bool q_erase(queue_t *q, list_ele_t *e, char *sp, size_t bufsize)
+{
+    if (q == NULL || e == NULL)
+        return false;
+    ele_remove(q, e, sp, bufsize);
     return true;
 }
 
@@ -159,75 +575,1630 @@ void q_reverse(queue_t *q)
 {
     if (q == NULL || q->head == NULL)
         return;
-    q->tail = q->head;
-    while (q->tail->next != NULL) {
-        list_ele_t *target = q->tail->next;
-        q->tail->next = target->next;
-        target->next = q->head;
-        q->head = target;
+    /* Swap the links of every element, then the ends of the queue */
+    for (list_ele_t *e = q->head; e != NULL; e = e->prev) {
+        list_ele_t *target = e->next;
+        e->next = e->prev;
+        e->prev = target;
+    }
+    list_ele_t *target = q->head;
+    q->head = q->tail;
+    q->tail = target;
+}
+
+/*
+ * Sorting is an MSD radix sort over all 256 byte values.  The elements are
+ * distributed into buckets by their byte at some depth, and every bucket
+ * then by the next byte, until the buckets are small enough for insertion
+ * sort.  Strings ending at the depth form bucket 0 and need no more work.
+ * When all the strings land in the same bucket, the rest of the prefix
+ * they share is skipped in one go rather than with a pass per byte.  A
+ * bucket holding copies of a single string, which distributing notices
+ * along the way, is already in order and moves to the output whole.
+ *
+ * Instead of recursing once per byte, pending buckets go on an explicit
+ * stack, in reverse order so that the smallest byte is sorted first and
+ * the output is built front to back.  Small buckets are sorted right away
+ * and consecutive sorted ones share a single entry, so each entry left to
+ * sort holds at least RADIX_CUTOFF elements.  Should the stack still run
+ * out, the buckets at hand are merge sorted instead.
+ *
+ * With q_sort_nocase set, or Q_SORT_NOCASE given to q_sort_ex, bytes are
+ * folded to lower case first, which orders the strings as strcasecmp does.
+ * Every algorithm sorts in ascending order, and only maintains the next
+ * links; the pass restoring the prev links lays out a descending order.
+ */
+
+int q_sort_nocase = 0;
+
+/* Buckets smaller than this are sorted by insertion */
+#define RADIX_CUTOFF 32
+
+/* Entries of the stack of pending buckets */
+#define RADIX_STACK 1024
+
+/*
+ * A bucket left with all but 1/RADIX_STALL of its group shows that bytes
+ * barely tell these strings apart.  Should that happen twice in a row,
+ * comparisons are cheaper than more passes, and the bucket is merge sorted.
+ */
+#define RADIX_STALL 16
+
+typedef struct {
+    list_ele_t *head, *tail; /* Chain of elements linked by next */
+    size_t count;
+    size_t depth;            /* Strings agree on the bytes before depth */
+    bool sorted;             /* Chain already in order, just output it */
+    bool stalled;            /* See RADIX_STALL */
+} radix_group_t;
+
+static inline __attribute__((always_inline)) unsigned char
+key_byte(const char *s, size_t depth, bool nocase)
+{
+    unsigned char c = s[depth];
+    if (nocase && c >= 'A' && c <= 'Z')
+        c += 'a' - 'A';
+    return c;
+}
+
+/* Fold the upper case letters among the bytes of a key to lower case */
+static inline uint64_t fold_key(uint64_t key)
+{
+    const uint64_t ones = 0x0101010101010101ULL, high = ones * 0x80;
+    uint64_t low = key & ~high;
+    /* The high bit of a byte tells whether it is at least 'A', above 'Z' */
+    uint64_t ge_a = low + ones * (0x80 - 'A');
+    uint64_t gt_z = low + ones * (0x80 - 'Z' - 1);
+    uint64_t upper = (ge_a ^ gt_z) & ~key & high;
+    return key | upper >> 2;
+}
+
+/* Byte at depth of the string of e, which is at least depth bytes long */
+static inline __attribute__((always_inline)) unsigned char
+ele_byte(list_ele_t *e, size_t depth, bool nocase)
+{
+#ifdef QUEUE_SORT_KEY
+    if (depth < 8) {
+        unsigned char c = e->key >> (56 - 8 * depth);
+        if (nocase && c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        return c;
     }
+#endif
+    return key_byte(e->value, depth, nocase);
 }
 
 /*
- * Sort elements of linked list in ascending order using recursive radix sort
- * @param head - a pointer to the pointer to head of the list
- * @param tail - a pointer to the pointer to tail of the list
- * @param index - the index of character in string now checking
+ * Compare the strings of a and b from byte depth on, both being at least
+ * depth bytes long.  Unless the keys tie, they settle it without touching
+ * the strings, and so does a tie when either string ends within its key.
+ * Without cached keys, the strings are compared right away.
  */
-void q_ele_radixsort(list_ele_t **head, list_ele_t **tail, int index)
+static inline __attribute__((always_inline)) int
+key_cmp(list_ele_t *a, list_ele_t *b, size_t depth, bool nocase)
 {
-    if (*head == *tail)
-        return;
+#ifdef QUEUE_SORT_KEY
+    if (depth < 8) {
+        uint64_t x = a->key, y = b->key;
+        if (nocase) {
+            x = fold_key(x);
+            y = fold_key(y);
+        }
+        x <<= 8 * depth;
+        y <<= 8 * depth;
+        if (x != y)
+            return x < y ? -1 : 1;
+        if (a->len < 8 || b->len < 8)
+            return 0;
+        depth = 8;
+    }
+#endif
+    return nocase ? str_casecmp(a->value + depth, b->value + depth)
+                  : str_cmp(a->value + depth, b->value + depth);
+}
 
-    list_ele_t *bucket_head[27], *bucket_tail[27];
-    list_ele_t *target = *head;
-    for (int iter = 0; iter < 27; ++iter)
-        bucket_head[iter] = bucket_tail[iter] = NULL;
-    
-    while (target != NULL) {
-        int charCode = (int)(target->value[index]);
-        charCode = (charCode == 0) ? 0 : charCode - 'a' + 1;
-        if (bucket_head[charCode] == NULL)
-            bucket_head[charCode] = target;
-        else
-            bucket_tail[charCode]->next = target;
-        bucket_tail[charCode] = target;
-        target = target->next;
-        bucket_tail[charCode]->next = NULL;
+/* Sort a short chain by insertion, setting *tail to its last element */
+static inline __attribute__((always_inline)) list_ele_t *
+insertion_sort(list_ele_t *list, size_t depth, bool nocase, list_ele_t **tail)
+{
+    list_ele_t *sorted = NULL, *last = NULL;
+    while (list) {
+        list_ele_t *e = list;
+        list = list->next;
+        if (last == NULL || key_cmp(last, e, depth, nocase) <= 0) {
+            /* Already in order, the common case for nearly sorted input */
+            e->next = NULL;
+            if (last)
+                last->next = e;
+            else
+                sorted = e;
+            last = e;
+            continue;
+        }
+        /* Some element is greater than e, last at least, so this stops */
+        list_ele_t **p = &sorted;
+        while (key_cmp(*p, e, depth, nocase) <= 0)
+            p = &(*p)->next;
+        e->next = *p;
+        *p = e;
     }
+    *tail = last;
+    return sorted;
+}
 
-    for (int iter = 1; iter < 27; ++iter) {
-        if (bucket_head[iter] != bucket_tail[iter])
-            q_ele_radixsort(&bucket_head[iter], &bucket_tail[iter], index + 1);
+static inline __attribute__((always_inline)) list_ele_t *
+merge(list_ele_t *a, list_ele_t *b, size_t depth, bool nocase)
+{
+    list_ele_t *head = NULL, **p = &head;
+    while (a && b) {
+        if (key_cmp(a, b, depth, nocase) <= 0) {
+            *p = a;
+            a = a->next;
+        } else {
+            *p = b;
+            b = b->next;
+        }
+        p = &(*p)->next;
     }
+    *p = a ? a : b;
+    return head;
+}
 
-    bool isHead = true;
-    for (int iter = 0; iter < 27; ++iter) {
-        if (bucket_head[iter] != NULL) {
-            if (isHead) {
-                *head = bucket_head[iter];
-                isHead = false;
-            } else {
-                (*tail)->next = bucket_head[iter];
+/*
+ * Sort a chain by bottom-up merge sort, setting *tail to its last element.
+ * Slot i of parts holds a sorted chain of 2^i elements, if any.
+ */
+static inline __attribute__((always_inline)) list_ele_t *
+merge_sort(list_ele_t *list, size_t depth, bool nocase, list_ele_t **tail)
+{
+    list_ele_t *parts[64] = {NULL};
+    int max = 0;
+    while (list) {
+        list_ele_t *e = list;
+        list = list->next;
+        e->next = NULL;
+        int i = 0;
+        for (; parts[i]; i++) {
+            e = merge(parts[i], e, depth, nocase);
+            parts[i] = NULL;
+        }
+        parts[i] = e;
+        if (i > max)
+            max = i;
+    }
+    list_ele_t *result = NULL;
+    for (int i = 0; i <= max; i++)
+        if (parts[i])
+            result = result ? merge(parts[i], result, depth, nocase)
+                            : parts[i];
+    *tail = result;
+    while (*tail && (*tail)->next)
+        *tail = (*tail)->next;
+    return result;
+}
+
+/* Length of the prefix the strings of a chain share from byte depth on */
+static inline __attribute__((always_inline)) size_t
+common_prefix(list_ele_t *list, size_t depth, bool nocase)
+{
+    const char *first = list->value + depth;
+    size_t len = strlen(first);
+    for (list_ele_t *e = list->next; e != NULL && len > 0; e = e->next) {
+        const char *s = e->value + depth;
+        size_t i = 0;
+        while (i < len && key_byte(first, i, nocase) == key_byte(s, i, nocase))
+            i++;
+        len = i;
+    }
+    return len;
+}
+
+/*
+ * Distribute the chain from head into 256 buckets by the byte at depth.
+ * The chains of the buckets are not terminated.  Unless bucket_equal is
+ * NULL, bucket_equal[c] tells whether the strings of bucket c are all equal,
+ * which costs a comparison per element only until they differ.
+ */
+static inline __attribute__((always_inline)) void
+distribute(list_ele_t *head,
+           size_t depth,
+           bool nocase,
+           list_ele_t **bucket_head,
+           list_ele_t **bucket_tail,
+           size_t *bucket_count,
+           bool *bucket_equal)
+{
+    for (int c = 0; c < 256; c++) {
+        bucket_head[c] = NULL;
+        bucket_count[c] = 0;
+    }
+    for (list_ele_t *e = head; e != NULL; e = e->next) {
+        unsigned char c = ele_byte(e, depth, nocase);
+        if (bucket_head[c] == NULL) {
+            bucket_head[c] = e;
+            if (bucket_equal != NULL)
+                bucket_equal[c] = true;
+        } else {
+            if (bucket_equal != NULL && bucket_equal[c])
+                bucket_equal[c] =
+                    key_cmp(bucket_tail[c], e, depth, nocase) == 0;
+            bucket_tail[c]->next = e;
+        }
+        bucket_tail[c] = e;
+        bucket_count[c]++;
+    }
+}
+
+/*
+ * Sort the count elements of the chain from head, which agree on the bytes
+ * before depth, and return the new head.
+ */
+static inline __attribute__((always_inline)) list_ele_t *
+radix_sort(list_ele_t *head, size_t count, size_t depth, bool nocase)
+{
+    radix_group_t stack[RADIX_STACK];
+    list_ele_t *bucket_head[256], *bucket_tail[256];
+    size_t bucket_count[256];
+    bool bucket_equal[256];
+    list_ele_t *out = NULL, **out_next = &out;
+    int top = 0;
+
+    stack[top++] = (radix_group_t){head, NULL, count, depth, false, false};
+    while (top > 0) {
+        radix_group_t g = stack[--top];
+        if (!g.sorted && g.count < RADIX_CUTOFF) {
+            g.head = insertion_sort(g.head, g.depth, nocase, &g.tail);
+            g.sorted = true;
+        }
+        if (g.sorted) {
+            *out_next = g.head;
+            out_next = &g.tail->next;
+            continue;
+        }
+
+        distribute(g.head, g.depth, nocase, bucket_head, bucket_tail,
+                   bucket_count, bucket_equal);
+
+        /* The strings ending here are equal, they come first */
+        if (bucket_head[0] != NULL) {
+            *out_next = bucket_head[0];
+            out_next = &bucket_tail[0]->next;
+        }
+
+        size_t depth = g.depth + 1;
+        unsigned char first = ele_byte(g.head, g.depth, nocase);
+        if (first != 0 && bucket_count[first] == g.count &&
+            bucket_equal[first]) {
+            /* Copies of a single string, which are in order as they are */
+            *out_next = bucket_head[first];
+            out_next = &bucket_tail[first]->next;
+            continue;
+        }
+        if (first != 0 && bucket_count[first] == g.count) {
+            /* No split at all, skip the rest of the shared prefix at once */
+            g.depth = depth + common_prefix(g.head, depth, nocase);
+            g.stalled = false;
+            stack[top++] = g;
+            continue;
+        }
+        if (top + 256 > RADIX_STACK) {
+            /* No room to defer the buckets, finish them in order now */
+            for (int c = 1; c < 256; c++) {
+                if (bucket_head[c] == NULL)
+                    continue;
+                bucket_tail[c]->next = NULL;
+                list_ele_t *tail;
+                *out_next = merge_sort(bucket_head[c], depth, nocase, &tail);
+                out_next = &tail->next;
+            }
+            continue;
+        }
+
+        /* Push the buckets from the largest byte down */
+        list_ele_t *done_head = NULL, *done_tail = NULL;
+        for (int c = 255; c > 0; c--) {
+            if (bucket_head[c] == NULL)
+                continue;
+            bucket_tail[c]->next = NULL;
+            bool stalled = bucket_count[c] > g.count - g.count / RADIX_STALL;
+            if (bucket_equal[c] || bucket_count[c] < RADIX_CUTOFF ||
+                (stalled && g.stalled)) {
+                /* Sort it now and put it in front of the sorted ones */
+                list_ele_t *tail = bucket_tail[c];
+                list_ele_t *h =
+                    bucket_equal[c] ? bucket_head[c]
+                    : bucket_count[c] < RADIX_CUTOFF
+                        ? insertion_sort(bucket_head[c], depth, nocase, &tail)
+                        : merge_sort(bucket_head[c], depth, nocase, &tail);
+                tail->next = done_head;
+                if (done_tail == NULL)
+                    done_tail = tail;
+                done_head = h;
+                continue;
             }
-            *tail = bucket_tail[iter];
+            if (done_head != NULL) {
+                stack[top++] = (radix_group_t){done_head, done_tail, 0, depth,
+                                               true, false};
+                done_head = done_tail = NULL;
+            }
+            stack[top++] = (radix_group_t){bucket_head[c], bucket_tail[c],
+                                           bucket_count[c], depth, false,
+                                           stalled};
         }
+        if (done_head != NULL)
+            stack[top++] = (radix_group_t){done_head, done_tail, 0, depth,
+                                           true, false};
     }
+    *out_next = NULL;
+    return out;
+}
+
+/*
+ * The natural merge sort takes the input as it comes, in maximal runs that
+ * are either ascending or strictly descending.  A descending run is
+ * reversed while it is read, which keeps the sort stable since its
+ * elements are all distinct.  Runs wait on a stack, each more than twice
+ * as long as the one above it, and are merged whenever that would no
+ * longer hold, which balances the merges and bounds the stack by the
+ * number of bits of a size.  Sorted or reversed input is thus a single
+ * run, read in linear time.
+ *
+ * Merging first checks whether the runs are in order already.  Otherwise,
+ * once one run has supplied MIN_GALLOP elements in a row, the merge
+ * gallops: it probes that run at doubling distances for the end of its
+ * elements preceding the head of the other run, and moves them at once.
+ */
+
+int q_sort_engine = Q_SORT_RADIX;
 
+/* Elements in a row taken from one run before galloping */
+#define MIN_GALLOP 7
+
+typedef struct {
+    list_ele_t *head, *tail;
+    size_t len;
+} sort_run_t;
+
+/* Does a come before key, or before or along with it unless strict? */
+static inline __attribute__((always_inline)) bool
+precedes(list_ele_t *a, list_ele_t *key, bool strict, bool nocase)
+{
+    int cmp = key_cmp(a, key, 0, nocase);
+    return strict ? cmp < 0 : cmp <= 0;
 }
 
 /*
- * Sort elements of queue in ascending order
- * No effect if q is NULL or empty. In addition, if q has only one
- * element, do nothing.
+ * Return the last element of the chain from list that precedes key, in the
+ * sense of precedes(), knowing that list itself does.  Probing at doubling
+ * distances and then bisecting takes a logarithmic number of comparisons,
+ * while following no more links than a linear scan.
  */
-void q_sort(queue_t *q)
+static inline __attribute__((always_inline)) list_ele_t *
+gallop(list_ele_t *list, list_ele_t *key, bool strict, bool nocase)
 {
-    if (q == NULL || q->head == NULL)
+    list_ele_t *lo = list;
+    size_t step = 1, gap;
+    for (;;) {
+        list_ele_t *e = lo;
+        size_t i = 0;
+        while (i < step && e->next != NULL) {
+            e = e->next;
+            i++;
+        }
+        if (i == 0)
+            return lo;
+        if (!precedes(e, key, strict, nocase)) {
+            gap = i;
+            break;
+        }
+        lo = e;
+        if (i < step)
+            return lo;
+        step *= 2;
+    }
+
+    /* The element gap links after lo is the first one not preceding key */
+    while (gap > 1) {
+        size_t half = gap / 2;
+        list_ele_t *e = lo;
+        for (size_t i = 0; i < half; i++)
+            e = e->next;
+        if (precedes(e, key, strict, nocase)) {
+            lo = e;
+            gap -= half;
+        } else {
+            gap = half;
+        }
+    }
+    return lo;
+}
+
+/* Merge run b into run a, which comes first in the input */
+static inline __attribute__((always_inline)) void
+merge_runs(sort_run_t *a, sort_run_t *b, bool nocase)
+{
+    a->len += b->len;
+    /* Runs from nearly sorted input often need no merging at all */
+    if (key_cmp(a->tail, b->head, 0, nocase) <= 0) {
+        a->tail->next = b->head;
+        a->tail = b->tail;
         return;
-    if (q->size == 1) {
-        /* no-op */
+    }
+    if (key_cmp(b->tail, a->head, 0, nocase) < 0) {
+        b->tail->next = a->head;
+        a->head = b->head;
         return;
     }
-    q_ele_radixsort(&(q->head), &(q->tail), 0);
+
+    list_ele_t *x = a->head, *y = b->head;
+    list_ele_t *head = NULL, **p = &head;
+    int x_wins = 0, y_wins = 0;
+    while (x && y) {
+        list_ele_t *last;
+        if (key_cmp(x, y, 0, nocase) <= 0) {
+            y_wins = 0;
+            last = ++x_wins < MIN_GALLOP ? x : gallop(x, y, false, nocase);
+            *p = x;
+            x = last->next;
+        } else {
+            x_wins = 0;
+            /* Elements of b only go before equal ones of a, for stability */
+            last = ++y_wins < MIN_GALLOP ? y : gallop(y, x, true, nocase);
+            *p = y;
+            y = last->next;
+        }
+        p = &last->next;
+    }
+    *p = x ? x : y;
+    if (y == NULL)
+        b->tail = a->tail;
+    a->head = head;
+    a->tail = b->tail;
+}
+
+/* Cut the run at the front of chain list off it into *run */
+static inline __attribute__((always_inline)) list_ele_t *
+next_run(list_ele_t *list, sort_run_t *run, bool nocase)
+{
+    list_ele_t *e = list;
+    run->len = 1;
+    if (e->next != NULL && key_cmp(e->next, e, 0, nocase) < 0) {
+        /* Strictly descending, reverse it on the fly */
+        list_ele_t *head = e;
+        e = e->next;
+        head->next = NULL;
+        run->tail = head;
+        while (e != NULL && key_cmp(e, head, 0, nocase) < 0) {
+            list_ele_t *next = e->next;
+            e->next = head;
+            head = e;
+            e = next;
+            run->len++;
+        }
+        run->head = head;
+        return e;
+    }
+
+    while (e->next != NULL && key_cmp(e, e->next, 0, nocase) <= 0) {
+        e = e->next;
+        run->len++;
+    }
+    list_ele_t *rest = e->next;
+    e->next = NULL;
+    run->head = list;
+    run->tail = e;
+    return rest;
+}
+
+/* Sort the chain from head by natural merge sort, return the new head */
+static inline __attribute__((always_inline)) list_ele_t *
+natural_merge_sort(list_ele_t *head, bool nocase)
+{
+    sort_run_t runs[64];
+    int top = 0;
+    while (head != NULL) {
+        head = next_run(head, &runs[top++], nocase);
+        while (top >= 2 && runs[top - 2].len <= 2 * runs[top - 1].len) {
+            merge_runs(&runs[top - 2], &runs[top - 1], nocase);
+            top--;
+        }
+    }
+    for (; top >= 2; top--)
+        merge_runs(&runs[top - 2], &runs[top - 1], nocase);
+    return runs[0].head;
+}
+
+/*
+ * The multikey quicksort of Bentley and Sedgewick works on an array built
+ * from the chain and linked back in order once sorted.  A segment of the
+ * array is partitioned three ways around the character of a pivot:
+ * smaller, equal and greater.  The first and last parts go on with the
+ * same character, the middle one with the next, so a byte of a string is
+ * looked at only until it is told apart from the others.  Runs of equal
+ * strings are done with as soon as they fill a middle part, whatever their
+ * number.
+ *
+ * A character here is a word of eight bytes of the string, packed like the
+ * sort key, and the array holds the current word of every element next to
+ * the pointer to it.  Partitions thus read the array alone, and an element
+ * is only looked up again, for its next word, once its current one ties.
+ * A word padded with zeros ends its string.  When a segment does not split
+ * at all, the rest of the prefix its strings share is skipped in one go,
+ * as radix sort does.
+ *
+ * The segment processed next is always the smallest part, the others wait
+ * on an explicit stack, the largest at the bottom.  Only the largest part
+ * can hold more than half of a segment, and it takes the place of that
+ * segment on the stack, so the stack grows by at most two entries per
+ * halving: twice the number of bits of a size.
+ *
+ * The array needs space for every element, which q_sort cannot allocate:
+ * the test harness forbids it.  It is taken beforehand by q_sort_prepare,
+ * and without it q_sort falls back to radix sort.
+ */
+
+/* Segments smaller than this are sorted by insertion */
+#define MKQS_CUTOFF 16
+
+/* Entries of the stack of pending segments */
+#define MKQS_STACK 130
+
+typedef struct {
+    uint64_t word; /* Bytes depth to depth + 7 of the string */
+    list_ele_t *ele;
+} sort_item_t;
+
+typedef struct {
+    sort_item_t *a;
+    size_t n;
+    size_t depth; /* Strings agree on the bytes before depth */
+} mkqs_segment_t;
+
+/*
+ * Word of the bytes from depth on of the string of e, which is at least
+ * depth bytes long, padded with zeros past its end
+ */
+static inline __attribute__((always_inline)) uint64_t
+mkqs_word(list_ele_t *e, size_t depth, bool nocase)
+{
+    uint64_t word = depth == 0 ? ele_key(e) : str_word(e->value + depth);
+    return nocase ? fold_key(word) : word;
+}
+
+static inline __attribute__((always_inline)) void
+mkqs_load(sort_item_t *a, size_t n, size_t depth, bool nocase)
+{
+    for (size_t i = 0; i < n; i++)
+        a[i].word = mkqs_word(a[i].ele, depth, nocase);
+}
+
+/* Compare the strings of x and y from byte depth on, words first */
+static inline __attribute__((always_inline)) int
+mkqs_cmp(sort_item_t *x, sort_item_t *y, size_t depth, bool nocase)
+{
+    if (x->word != y->word)
+        return x->word < y->word ? -1 : 1;
+    if ((x->word & 0xff) == 0)
+        return 0;
+    const char *s = x->ele->value + depth + 8, *t = y->ele->value + depth + 8;
+    return nocase ? str_casecmp(s, t) : str_cmp(s, t);
+}
+
+static inline __attribute__((always_inline)) void
+mkqs_insertion_sort(sort_item_t *a, size_t n, size_t depth, bool nocase)
+{
+    for (size_t i = 1; i < n; i++) {
+        sort_item_t item = a[i];
+        size_t j = i;
+        for (; j > 0 && mkqs_cmp(&a[j - 1], &item, depth, nocase) > 0; j--)
+            a[j] = a[j - 1];
+        a[j] = item;
+    }
+}
+
+static inline uint64_t median3(uint64_t x, uint64_t y, uint64_t z)
+{
+    if (x > y) {
+        uint64_t t = x;
+        x = y;
+        y = t;
+    }
+    return z <= x ? x : z >= y ? y : z;
+}
+
+/* Length of the prefix the strings of a[0] to a[n - 1] share from depth */
+static inline __attribute__((always_inline)) size_t
+mkqs_common_prefix(sort_item_t *a, size_t n, size_t depth, bool nocase)
+{
+    const char *first = a[0].ele->value + depth;
+    size_t len = ele_len(a[0].ele) - depth;
+    for (size_t i = 1; i < n && len > 0; i++) {
+        const char *s = a[i].ele->value + depth;
+        size_t k = 0;
+        while (k < len && key_byte(first, k, nocase) == key_byte(s, k, nocase))
+            k++;
+        len = k;
+    }
+    return len;
+}
+
+/*
+ * Sort the n elements of array a, which agree on the bytes before depth
+ * and hold their words from depth on
+ */
+static inline __attribute__((always_inline)) void
+mkqs(sort_item_t *a, size_t n, size_t depth, bool nocase)
+{
+    mkqs_segment_t stack[MKQS_STACK];
+    int top = 0;
+
+    stack[top++] = (mkqs_segment_t){a, n, depth};
+    while (top > 0) {
+        mkqs_segment_t s = stack[--top];
+        while (s.n >= MKQS_CUTOFF) {
+            uint64_t pivot = median3(s.a[0].word, s.a[s.n / 2].word,
+                                     s.a[s.n - 1].word);
+
+            /* a[0..lt) < pivot, a[lt..i) == pivot, a[gt..n) > pivot */
+            size_t lt = 0, i = 0, gt = s.n;
+            while (i < gt) {
+                sort_item_t t = s.a[i];
+                if (t.word < pivot) {
+                    s.a[i++] = s.a[lt];
+                    s.a[lt++] = t;
+                } else if (t.word > pivot) {
+                    s.a[i] = s.a[--gt];
+                    s.a[gt] = t;
+                } else {
+                    i++;
+                }
+            }
+
+            mkqs_segment_t part[3] = {
+                {s.a, lt, s.depth},
+                {s.a + lt, gt - lt, s.depth + 8},
+                {s.a + gt, s.n - gt, s.depth},
+            };
+            /* The equal strings go on with their next words, if any */
+            if ((pivot & 0xff) == 0) {
+                part[1].n = 0; /* Equal strings, already in order */
+            } else {
+                if (part[1].n == s.n)
+                    part[1].depth += mkqs_common_prefix(
+                        part[1].a, part[1].n, part[1].depth, nocase);
+                mkqs_load(part[1].a, part[1].n, part[1].depth, nocase);
+            }
+
+            /* Order the parts by size, go on with the smallest */
+            for (int k = 1; k < 3; k++)
+                for (int j = k; j > 0 && part[j - 1].n < part[j].n; j--) {
+                    mkqs_segment_t t = part[j];
+                    part[j] = part[j - 1];
+                    part[j - 1] = t;
+                }
+            for (int k = 0; k < 2; k++)
+                if (part[k].n > 0)
+                    stack[top++] = part[k];
+            s = part[2];
+        }
+        if (s.n > 1)
+            mkqs_insertion_sort(s.a, s.n, s.depth, nocase);
+    }
+}
+
+/*
+ * Sort the count elements of the chain from head, which agree on the bytes
+ * before depth, by multikey quicksort in array a, and return the new head
+ */
+static inline __attribute__((always_inline)) list_ele_t *
+mkqs_sort(list_ele_t *head,
+          size_t count,
+          size_t depth,
+          bool nocase,
+          sort_item_t *a)
+{
+    list_ele_t *e = head;
+    for (size_t i = 0; i < count; i++, e = e->next)
+        a[i] = (sort_item_t){mkqs_word(e, depth, nocase), e};
+    mkqs(a, count, depth, nocase);
+    for (size_t i = 0; i + 1 < count; i++)
+        a[i].ele->next = a[i + 1].ele;
+    a[count - 1].ele->next = NULL;
+    return a[0].ele;
+}
+
+/*
+ * Burstsort builds a trie of the strings on the fly.  A node of the trie
+ * has a bucket per byte value, holding the strings that reach it with that
+ * byte, and a bucket bursts into a node of its own once it grows past
+ * BURST_LIMIT strings.  The strings are thus inserted one by one, each
+ * walking down the trie as far as it goes, into buckets which stay small
+ * enough to be sorted within the cache.  Walking the trie in order then
+ * sorts its buckets one after the other by radix sort, and links them.
+ *
+ * A bucket is a chain of elements, new ones going in front, so that
+ * inserting a string only writes to its own element.  Bucket 0 of a node
+ * holds the strings ending there, which are equal and never burst.
+ *
+ * The nodes come from a pool taken beforehand by q_sort_prepare, with
+ * room for twice as many nodes as there are full buckets' worth of
+ * strings, far more than input short of long shared prefixes ever needs.
+ * With 256 buckets of 24 bytes, a node takes about 6KB, so the pool comes
+ * to about 12 bytes per element.
+ * Once the pool runs out, buckets just grow, and radix sort takes them as
+ * they are.  Without the pool, q_sort falls back to radix sort entirely.
+ */
+
+/* Strings in a bucket before it bursts */
+#define BURST_LIMIT 1024
+
+typedef struct BURST_NODE {
+    struct {
+        list_ele_t *head;         /* Chain of the strings with this byte */
+        struct BURST_NODE *child; /* Or the node the bucket burst into */
+        size_t count;
+    } bucket[256];
+    struct BURST_NODE *parent;
+    int byte;     /* Byte of the bucket of the parent this node replaced */
+    size_t depth; /* Strings agree on the bytes before depth */
+} burst_node_t;
+
+typedef struct {
+    burst_node_t *next, *end; /* Nodes left */
+} burst_pool_t;
+
+static burst_node_t *burst_node(burst_pool_t *pool,
+                                burst_node_t *parent,
+                                int byte,
+                                size_t depth)
+{
+    if (pool->next == pool->end)
+        return NULL;
+    burst_node_t *node = pool->next++;
+    memset(node->bucket, 0, sizeof(node->bucket));
+    node->parent = parent;
+    node->byte = byte;
+    node->depth = depth;
+    return node;
+}
+
+/* Put e, which agrees with the strings of node on their bytes, in a bucket */
+static inline __attribute__((always_inline)) void
+burst_add(burst_node_t *node, list_ele_t *e, bool nocase)
+{
+    unsigned char c = ele_byte(e, node->depth, nocase);
+    e->next = node->bucket[c].head;
+    node->bucket[c].head = e;
+    node->bucket[c].count++;
+}
+
+/* Burst bucket c of node into a new node, if the pool has one left */
+static inline __attribute__((always_inline)) void
+burst(burst_pool_t *pool, burst_node_t *node, int c, bool nocase)
+{
+    burst_node_t *child = burst_node(pool, node, c, node->depth + 1);
+    if (child == NULL)
+        return;
+    for (list_ele_t *e = node->bucket[c].head, *next; e != NULL; e = next) {
+        next = e->next;
+        burst_add(child, e, nocase);
+    }
+    node->bucket[c].child = child;
+    node->bucket[c].head = NULL;
+    node->bucket[c].count = 0;
+}
+
+/*
+ * Sort the chain from head, whose strings agree on the bytes before depth,
+ * by burstsort with the nodes of pool, and return the new head
+ */
+static inline __attribute__((always_inline)) list_ele_t *
+burst_sort(list_ele_t *head, size_t depth, bool nocase, burst_pool_t *pool)
+{
+    burst_node_t *root = burst_node(pool, NULL, 0, depth);
+    /* Bucket of the previous string, into which its copies go directly */
+    list_ele_t *prev = NULL;
+    burst_node_t *prev_node = NULL;
+    unsigned char prev_c = 0;
+    for (list_ele_t *e = head, *next; e != NULL; e = next) {
+        next = e->next;
+        burst_node_t *node = prev_node;
+        unsigned char c = prev_c;
+        if (prev == NULL || key_cmp(prev, e, depth, nocase) != 0) {
+            node = root;
+            c = ele_byte(e, node->depth, nocase);
+            while (node->bucket[c].child != NULL) {
+                node = node->bucket[c].child;
+                c = ele_byte(e, node->depth, nocase);
+            }
+        }
+        e->next = node->bucket[c].head;
+        node->bucket[c].head = e;
+        prev = e;
+        prev_node = node;
+        prev_c = c;
+        if (++node->bucket[c].count > BURST_LIMIT && c != 0) {
+            burst(pool, node, c, nocase);
+            prev = NULL; /* The bucket is gone */
+        }
+    }
+
+    /* Walk the trie in order, without a stack thanks to the parent links */
+    list_ele_t *out = NULL, **out_next = &out;
+    burst_node_t *node = root;
+    int c = 0;
+    while (node != NULL) {
+        if (c == 256) {
+            c = node->byte + 1;
+            node = node->parent;
+            continue;
+        }
+        if (node->bucket[c].child != NULL) {
+            node = node->bucket[c].child;
+            c = 0;
+            continue;
+        }
+        list_ele_t *e = node->bucket[c].head;
+        if (e != NULL) {
+            /* Strings ending here are equal, the others need sorting */
+            if (c != 0)
+                e = radix_sort(e, node->bucket[c].count, node->depth + 1,
+                               nocase);
+            *out_next = e;
+            while (e->next != NULL)
+                e = e->next;
+            out_next = &e->next;
+        }
+        c++;
+    }
+    *out_next = NULL;
+    return out;
+}
+
+/*
+ * Bytes of the space the selected algorithm needs beyond the elements, for
+ * count of them.  Never more for a chain than for any longer one holding
+ * it, so that a share of the space suffices for a share of the elements.
+ */
+static size_t sort_space(size_t count)
+{
+    switch (q_sort_engine) {
+    case Q_SORT_MKQS:
+        return count * sizeof(sort_item_t);
+    case Q_SORT_BURST:
+        return 2 * (count / BURST_LIMIT) * sizeof(burst_node_t);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Sort the count elements of the chain from head, which agree on the bytes
+ * before depth, with the selected algorithm and return the new head.
+ * Space buf holds sort_space(count) bytes, or is NULL if none was prepared.
+ * Always inlined, like the algorithms themselves, so that each instance
+ * below compiles all of them for its own value of nocase.
+ */
+static inline __attribute__((always_inline)) list_ele_t *
+sort_chain(list_ele_t *head, size_t count, size_t depth, bool nocase, void *buf)
+{
+    switch (q_sort_engine) {
+    case Q_SORT_MERGE:
+        return natural_merge_sort(head, nocase);
+    case Q_SORT_MKQS:
+        if (buf != NULL)
+            return mkqs_sort(head, count, depth, nocase, buf);
+        break;
+    case Q_SORT_BURST:
+        if (buf != NULL && count > BURST_LIMIT) {
+            burst_pool_t pool = {buf, (burst_node_t *) buf +
+                                          2 * (count / BURST_LIMIT)};
+            return burst_sort(head, depth, nocase, &pool);
+        }
+        break;
+    }
+    return radix_sort(head, count, depth, nocase);
+}
+
+typedef list_ele_t *(*sort_fn_t)(list_ele_t *head,
+                                 size_t count,
+                                 size_t depth,
+                                 void *buf);
+
+/*
+ * There is one sort_chain per case mode, nocase being constant in each, as
+ * with the quicksorts of the other queues.  Sorts pick theirs once.
+ */
+#define SORT_CHAIN(name, nocase)                                 \
+    static list_ele_t *name(list_ele_t *head, size_t count,      \
+                            size_t depth, void *buf)             \
+    {                                                            \
+        return sort_chain(head, count, depth, nocase, buf);      \
+    }
+
+SORT_CHAIN(sort_chain_case, false)
+SORT_CHAIN(sort_chain_nocase, true)
+
+static inline sort_fn_t sort_chain_for(bool nocase)
+{
+    return nocase ? sort_chain_nocase : sort_chain_case;
+}
+
+/*
+ * Link the chain from head, sorted in ascending order, after the list from
+ * *first to *last, setting the prev links the sorts leave out.  In
+ * descending order, the chain goes backwards before *first instead, which
+ * takes the same single pass.  Both are NULL for an empty list.
+ */
+static void link_sorted(list_ele_t *head,
+                        bool desc,
+                        list_ele_t **first,
+                        list_ele_t **last)
+{
+    list_ele_t *f = *first, *l = *last;
+    if (desc) {
+        for (list_ele_t *e = head, *next; e != NULL; e = next) {
+            next = e->next;
+            e->prev = NULL;
+            e->next = f;
+            if (f != NULL)
+                f->prev = e;
+            else
+                l = e;
+            f = e;
+        }
+    } else {
+        for (list_ele_t *e = head; e != NULL; e = e->next) {
+            e->prev = l;
+            if (l != NULL)
+                l->next = e;
+            else
+                f = e;
+            l = e;
+        }
+    }
+    *first = f;
+    *last = l;
+}
+
+/*
+ * With q_sort_threads above 1, large queues are sorted in parallel.  The
+ * elements are distributed by their first byte, and every thread sorts a
+ * range of consecutive buckets holding about its share of the elements.
+ * The buckets are independent, so the sorted ranges only have to be linked
+ * one after the other.  A queue whose elements nearly all start with the
+ * same byte thus gains little.
+ *
+ * SIGALRM is blocked while the threads run, in the calling thread too, so
+ * that the time limit of the test harness cannot interrupt the sort
+ * halfway.  A pending signal is delivered once the queue is whole again.
+ */
+
+int q_sort_threads = 1;
+
+/* Most threads a sort uses */
+#define SORT_THREADS_MAX 64
+
+/* Fewest elements worth a thread of their own */
+#define SORT_THREAD_MIN 16384
+
+typedef struct {
+    list_ele_t **bucket_head, **bucket_tail;
+    size_t *bucket_count;
+    int lo, hi; /* Range of buckets to sort */
+    sort_fn_t sort;
+    bool desc;
+    void *buf;               /* Share of the sort space, or NULL */
+    list_ele_t *head, *tail; /* Sorted elements of the range */
+} sort_task_t;
+
+/* Sort the buckets of a task and link them, prev links included */
+static void *sort_task(void *arg)
+{
+    sort_task_t *t = arg;
+    t->head = t->tail = NULL;
+    for (int c = t->lo; c < t->hi; c++) {
+        if (t->bucket_head[c] == NULL)
+            continue;
+        t->bucket_tail[c]->next = NULL;
+        list_ele_t *e =
+            t->sort(t->bucket_head[c], t->bucket_count[c], 1, t->buf);
+        link_sorted(e, t->desc, &t->head, &t->tail);
+    }
+    return NULL;
+}
+
+static void parallel_sort(queue_t *q,
+                          int nthreads,
+                          sort_fn_t sort,
+                          bool nocase,
+                          bool desc,
+                          void *buf)
+{
+    list_ele_t *bucket_head[256], *bucket_tail[256];
+    size_t bucket_count[256];
+    sort_task_t tasks[SORT_THREADS_MAX];
+    pthread_t threads[SORT_THREADS_MAX];
+    bool started[SORT_THREADS_MAX];
+
+    distribute(q->head, 0, nocase, bucket_head, bucket_tail, bucket_count,
+               NULL);
+
+    /*
+     * Cut the buckets into ranges of about size / nthreads elements.  Each
+     * range gets its share of buf, after those of the ranges before it.
+     */
+    size_t share = (q->size - bucket_count[0]) / nthreads + 1, sum = 0;
+    size_t start = 0; /* Elements in the ranges before this one */
+    int ntasks = 0, lo = 1;
+    for (int c = 1; c < 256; c++) {
+        sum += bucket_count[c];
+        if (c == 255 ||
+            (ntasks < nthreads - 1 && sum >= share * (ntasks + 1))) {
+            tasks[ntasks++] = (sort_task_t){bucket_head, bucket_tail,
+                                            bucket_count, lo, c + 1, sort,
+                                            desc,
+                                            buf ? (char *) buf +
+                                                      sort_space(start)
+                                                : NULL,
+                                            NULL, NULL};
+            lo = c + 1;
+            start = sum;
+        }
+    }
+
+    sigset_t alarm, saved;
+    sigemptyset(&alarm);
+    sigaddset(&alarm, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alarm, &saved);
+
+    /* This thread takes the first range, the others get one thread each */
+    for (int i = 1; i < ntasks; i++)
+        started[i] = pthread_create(&threads[i], NULL, sort_task,
+                                    &tasks[i]) == 0;
+    sort_task(&tasks[0]);
+    for (int i = 1; i < ntasks; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            sort_task(&tasks[i]);
+    }
+
+    /*
+     * Empty strings come first, then the ranges in order.  In descending
+     * order, each range goes before those linked so far instead.
+     */
+    list_ele_t *head = NULL, *tail = NULL;
+    if (bucket_head[0] != NULL) {
+        bucket_tail[0]->next = NULL;
+        link_sorted(bucket_head[0], desc, &head, &tail);
+    }
+    for (int i = 0; i < ntasks; i++) {
+        if (tasks[i].head == NULL)
+            continue;
+        if (desc) {
+            tasks[i].tail->next = head;
+            if (head != NULL)
+                head->prev = tasks[i].tail;
+            else
+                tail = tasks[i].tail;
+            head = tasks[i].head;
+        } else {
+            tasks[i].head->prev = tail;
+            if (tail != NULL)
+                tail->next = tasks[i].head;
+            else
+                head = tasks[i].head;
+            tail = tasks[i].tail;
+        }
+    }
+    q->head = head;
+    q->tail = tail;
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+/*
+ * Sort elements of queue in the order given by flags, see q_sort_ex
+ * No effect if q is NULL or empty. In addition, if q has only one
+ * element, do nothing.
+ */
+void q_sort_ex(queue_t *q, int flags)
+{
+    if (q == NULL || q->head == NULL)
+        return;
+    if (q->size == 1) {
+        /* no-op */
+        return;
+    }
+
+    int nthreads = q->size / SORT_THREAD_MIN;
+    if (nthreads > q_sort_threads)
+        nthreads = q_sort_threads;
+    if (nthreads > SORT_THREADS_MAX)
+        nthreads = SORT_THREADS_MAX;
+    /* The space of the sort algorithm, if q_sort_prepare got enough */
+    size_t space = sort_space(q->size);
+    void *buf = space > 0 && q->sort_cap >= space ? q->sort_buf : NULL;
+    bool nocase = flags & Q_SORT_NOCASE, desc = flags & Q_SORT_DESC;
+    sort_fn_t sort = sort_chain_for(nocase);
+    if (nthreads > 1) {
+        parallel_sort(q, nthreads, sort, nocase, desc, buf);
+        return;
+    }
+
+    list_ele_t *e = sort(q->head, q->size, 0, buf);
+    q->head = q->tail = NULL;
+    link_sorted(e, desc, &q->head, &q->tail);
+}
+
+/*
+ * Sort elements of queue in ascending order
+ */
+void q_sort(queue_t *q)
+{
+    q_sort_ex(q, q_sort_nocase ? Q_SORT_NOCASE : 0);
+}
+
+/*
+ * Partial sort keeps the k smallest elements seen so far as a sorted chain.
+ * Any later element no less than the greatest of them cannot take its
+ * place, and goes straight to the rest.  The others gather as candidates
+ * until there are k of them, to be sorted and merged with the chain, which
+ * keeps the k first of the merge and sends the others to the rest.  Every
+ * round of k candidates costs O(k log k), hence O(n log k) overall, and a
+ * round only comes when k elements have beaten the greatest one kept, which
+ * soon gets rare on random input.
+ */
+
+/*
+ * Merge the sorted chains a, of k elements, and b, keeping the first k of
+ * the merge, set *last to the last of them, and prepend the other elements
+ * to chain *rest.  Return the head of the kept chain.
+ */
+static list_ele_t *merge_first(list_ele_t *a,
+                               list_ele_t *b,
+                               size_t k,
+                               bool nocase,
+                               list_ele_t **last,
+                               list_ele_t **rest)
+{
+    list_ele_t *head = NULL, **p = &head;
+    for (size_t i = 0; i < k; i++) {
+        if (b == NULL || key_cmp(a, b, 0, nocase) <= 0) {
+            *p = a;
+            a = a->next;
+        } else {
+            *p = b;
+            b = b->next;
+        }
+        *last = *p;
+        p = &(*p)->next;
+    }
+    *p = NULL;
+    while (a != NULL || b != NULL) {
+        list_ele_t **from = a != NULL ? &a : &b;
+        list_ele_t *e = *from;
+        *from = e->next;
+        e->next = *rest;
+        *rest = e;
+    }
+    return head;
+}
+
+/*
+ * Move the k smallest elements of queue to its head, sorted, the others
+ * after them in no particular order
+ */
+void q_sort_partial(queue_t *q, int k)
+{
+    if (q == NULL || k <= 0)
+        return;
+    if (k >= q->size) {
+        q_sort(q);
+        return;
+    }
+
+    bool nocase = q_sort_nocase;
+    sort_fn_t sort = sort_chain_for(nocase);
+    size_t space = sort_space(k);
+    void *buf = space > 0 && q->sort_cap >= space ? q->sort_buf : NULL;
+
+    /* Start from the first k elements, cut from the others */
+    list_ele_t *cut = q->head;
+    for (int i = 1; i < k; i++)
+        cut = cut->next;
+    list_ele_t *list = cut->next;
+    cut->next = NULL;
+    list_ele_t *kept = sort(q->head, k, 0, buf), *last = kept;
+    while (last->next != NULL)
+        last = last->next;
+
+    list_ele_t *cand = NULL, *rest = NULL;
+    size_t ncand = 0;
+    while (list != NULL) {
+        list_ele_t *e = list;
+        list = list->next;
+        if (key_cmp(e, last, 0, nocase) >= 0) {
+            e->next = rest;
+            rest = e;
+            continue;
+        }
+        e->next = cand;
+        cand = e;
+        if (++ncand == (size_t) k) {
+            cand = sort(cand, ncand, 0, buf);
+            kept = merge_first(kept, cand, k, nocase, &last, &rest);
+            cand = NULL;
+            ncand = 0;
+        }
+    }
+    if (cand != NULL) {
+        cand = sort(cand, ncand, 0, buf);
+        kept = merge_first(kept, cand, k, nocase, &last, &rest);
+    }
+
+    /* The kept chain, then the rest, with the prev links restored */
+    last->next = rest;
+    q->head = kept;
+    kept->prev = NULL;
+    list_ele_t *e = kept;
+    for (; e->next != NULL; e = e->next)
+        e->next->prev = e;
+    q->tail = e;
+}
+
+/*
+ * Remove the elements equal to the one before them, each run of them at
+ * once.  Equal strings have the same length, so a run is a chain of one
+ * size class and goes back to the arena in one go.
+ */
+int q_dedup(queue_t *q)
+{
+    if (q == NULL || q->head == NULL)
+        return 0;
+    bool nocase = q_sort_nocase;
+    int removed = 0;
+    for (list_ele_t *e = q->head; e != NULL; e = e->next) {
+        list_ele_t *last = NULL;
+        for (list_ele_t *d = e->next;
+             d != NULL && key_cmp(e, d, 0, nocase) == 0; d = d->next) {
+            last = d;
+            removed++;
+        }
+        if (last == NULL)
+            continue;
+        list_ele_t *first = e->next;
+        e->next = last->next;
+        if (last->next != NULL)
+            last->next->prev = e;
+        else
+            q->tail = e;
+        arena_release_chain(q->arena, first, last, ele_len(e));
+    }
+    q->size -= removed;
+    return removed;
+}
+
+/*
+ * Allocate the space q_sort needs beyond the elements of q, should the
+ * selected algorithm need any.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_sort_prepare(queue_t *q)
+{
+    if (q == NULL)
+        return false;
+    size_t space = sort_space(q->size);
+    if (space == 0 || q->sort_cap >= space)
+        return true;
+    void *buf = malloc(space);
+    if (buf == NULL)
+        return false;
+    free(q->sort_buf);
+    q->sort_buf = buf;
+    q->sort_cap = space;
+    return true;
+}
+
+/* Free the space allocated by q_sort_prepare.  No effect if q is NULL */
+void q_sort_finish(queue_t *q)
+{
+    if (q == NULL)
+        return;
+    free(q->sort_buf);
+    q->sort_buf = NULL;
+    q->sort_cap = 0;
+}
+
+/* Let the elements of queue src move to queue dst, merging their arenas */
+static void share_arena(queue_t *dst, queue_t *src)
+{
+    if (src->arena == dst->arena)
+        return;
+    /* Every queue sharing the arena of src now uses that of dst */
+    arena_t *old = src->arena;
+    queue_t *r = src;
+    do {
+        r->arena = dst->arena;
+        r = r->sibling;
+    } while (r != src);
+    arena_merge(dst->arena, old);
+    /* Join the two circles of siblings */
+    queue_t *target = dst->sibling;
+    dst->sibling = src->sibling;
+    src->sibling = target;
+}
+
+/*
+ * Move all elements of queue src to the tail of queue dst, leaving src
+ * empty.
+ * Return true if successful.
+ * Return false if dst or src is NULL, or if they are the same queue.
+ */
+bool q_splice_tail(queue_t *dst, queue_t *src)
+{
+    if (dst == NULL || src == NULL || dst == src)
+        return false;
+    if (src->head == NULL)
+        return true;
+
+    share_arena(dst, src);
+    src->head->prev = dst->tail;
+    if (dst->tail != NULL)
+        dst->tail->next = src->head;
+    else
+        dst->head = src->head;
+    dst->tail = src->tail;
+    dst->size += src->size;
+    src->head = NULL;
+    src->tail = NULL;
+    src->size = 0;
+    return true;
+}
+
+/*
+ * Split queue q after its first k elements.
+ * Return a new queue holding the elements that followed them, or NULL if q
+ * is NULL or could not allocate space.
+ */
+queue_t *q_split(queue_t *q, int k)
+{
+    if (q == NULL)
+        return NULL;
+    queue_t *r = malloc(sizeof(queue_t));
+    if (r == NULL)
+        return NULL;
+    /* The elements stay in their arena, which r shares with q */
+    r->arena = q->arena;
+    r->sibling = q->sibling;
+    q->sibling = r;
+    r->head = NULL;
+    r->tail = NULL;
+    r->size = 0;
+    r->sort_buf = NULL;
+    r->sort_cap = 0;
+    if (k < 0)
+        k = 0;
+    if (k >= q->size)
+        return r;
+
+    /* Find the first element of r, walking from the nearer end */
+    list_ele_t *e;
+    if (k <= q->size / 2) {
+        e = q->head;
+        for (int i = 0; i < k; i++)
+            e = e->next;
+    } else {
+        e = q->tail;
+        for (int i = q->size - 1; i > k; i--)
+            e = e->prev;
+    }
+
+    r->head = e;
+    r->tail = q->tail;
+    r->size = q->size - k;
+    q->tail = e->prev;
+    if (q->tail != NULL)
+        q->tail->next = NULL;
+    else
+        q->head = NULL;
+    e->prev = NULL;
+    q->size = k;
+    return r;
+}
+
+/*
+ * The merge of q_merge_k picks the next element among the heads of the
+ * queues with a loser tree.  Node t of the tree, for t from 1 to k - 1,
+ * holds the queue that lost the match played there, and node 0 the overall
+ * winner, so replacing the winner's head takes a single match per level.
+ * Leaf k + i of the tree stands for queue i.
+ *
+ * The matches compare the keys of the heads, kept side by side in keys,
+ * and pick the winner with masks rather than branches, as who wins is
+ * unpredictable.  keys[i] is MERGE_DONE once queue i is exhausted.
+ *
+ * Walking a single list misses the cache at every element, one miss at a
+ * time.  So each queue has its next MERGE_AHEAD elements looked ahead, with
+ * their keys, and every MERGE_ROUND steps of the merge, a round adds one
+ * element to the look-ahead of every queue short of it.  The misses of a
+ * round are independent, so they overlap, and the matches never wait for
+ * one.  A round every 3k/4 steps keeps up as long as the queues take turns;
+ * a queue winning many times in a row has its look-ahead refilled one
+ * element at a time.
+ */
+
+/* Elements looked ahead in each queue, a power of 2 */
+#define MERGE_AHEAD 8
+
+/* Key of an exhausted queue, which merge_tie sets apart from a real one */
+#define MERGE_DONE UINT64_MAX
+
+/* A queue being merged */
+typedef struct {
+    list_ele_t *next;      /* First element not looked ahead, NULL at end */
+    unsigned first, count; /* Elements looked ahead, from ele[first] on */
+    list_ele_t *ele[MERGE_AHEAD];
+    uint64_t key[MERGE_AHEAD];
+} merge_src_t;
+
+/* Key of e, as the matches compare it */
+static inline uint64_t merge_key(list_ele_t *e, bool nocase)
+{
+    uint64_t key = ele_key(e);
+    return nocase ? fold_key(key) : key;
+}
+
+/* Look the next element of src ahead */
+static inline void merge_look(merge_src_t *src, bool nocase)
+{
+    list_ele_t *e = src->next;
+    unsigned i = (src->first + src->count) & (MERGE_AHEAD - 1);
+    src->ele[i] = e;
+    src->key[i] = merge_key(e, nocase);
+    src->count++;
+    src->next = e->next;
+}
+
+/*
+ * Does queue a come before queue b, their keys being equal?  Exhausted
+ * queues come last, and ties go to the lower queue.
+ */
+static bool merge_tie(merge_src_t *src, size_t a, size_t b, bool nocase)
+{
+    if (src[a].count == 0 || src[b].count == 0)
+        return src[b].count == 0 && (src[a].count != 0 || a < b);
+    int c = key_cmp(src[a].ele[src[a].first], src[b].ele[src[b].first], 0,
+                    nocase);
+    return c < 0 || (c == 0 && a < b);
+}
+
+static inline bool merge_before(merge_src_t *src,
+                                const uint64_t *keys,
+                                size_t a,
+                                size_t b,
+                                bool nocase)
+{
+    if (__builtin_expect(keys[a] == keys[b], 0))
+        return merge_tie(src, a, b, nocase);
+    return keys[a] < keys[b];
+}
+
+/* Replay the matches of queue s up the tree, leaving the winner in tree[0] */
+static inline void merge_adjust(size_t *tree,
+                                merge_src_t *src,
+                                const uint64_t *keys,
+                                size_t k,
+                                size_t s,
+                                bool nocase)
+{
+    uint64_t ks = keys[s];
+    for (size_t t = (s + k) / 2; t > 0; t /= 2) {
+        size_t other = tree[t];
+        uint64_t ko = keys[other];
+        bool lost = __builtin_expect(ko == ks, 0)
+                        ? merge_tie(src, other, s, nocase)
+                        : ko < ks;
+        /* All ones if the other queue wins, and moves on up */
+        size_t m = -(size_t) lost;
+        tree[t] = (other & ~m) | (s & m);
+        s = (s & ~m) | (other & m);
+        ks = (ks & ~(uint64_t) m) | (ko & (uint64_t) m);
+    }
+    tree[0] = s;
+}
+
+/*
+ * Merge the k sorted queues of qs into qs[0], leaving the others empty
+ */
+bool q_merge_k(queue_t **qs, size_t k)
+{
+    if (qs == NULL || k == 0)
+        return false;
+    for (size_t i = 0; i < k; i++)
+        if (qs[i] == NULL)
+            return false;
+    if (k == 1)
+        return true;
+
+    /* The upper half holds the winners of the matches while building */
+    size_t *tree = malloc(2 * k * sizeof(size_t));
+    merge_src_t *src = malloc(k * sizeof(merge_src_t));
+    uint64_t *keys = malloc(k * sizeof(uint64_t));
+    if (tree == NULL || src == NULL || keys == NULL) {
+        free(tree);
+        free(src);
+        free(keys);
+        return false;
+    }
+
+    bool nocase = q_sort_nocase;
+    queue_t *dst = qs[0];
+    for (size_t i = 0; i < k; i++) {
+        if (i > 0) {
+            share_arena(dst, qs[i]);
+            dst->size += qs[i]->size;
+        }
+        src[i].next = qs[i]->head;
+        src[i].first = src[i].count = 0;
+        qs[i]->head = NULL;
+        qs[i]->tail = NULL;
+    }
+    /* Fill the look-aheads a round at a time, so that the misses overlap */
+    for (int n = 0; n < MERGE_AHEAD; n++)
+        for (size_t i = 0; i < k; i++)
+            if (src[i].next != NULL)
+                merge_look(&src[i], nocase);
+    for (size_t i = 0; i < k; i++)
+        keys[i] = src[i].count ? src[i].key[0] : MERGE_DONE;
+
+    /* Play the matches bottom up, node t keeping the loser of its own */
+    size_t *winner = tree + k;
+    for (size_t t = k - 1; t > 0; t--) {
+        size_t l = 2 * t < k ? winner[2 * t] : 2 * t - k;
+        size_t r = 2 * t + 1 < k ? winner[2 * t + 1] : 2 * t + 1 - k;
+        bool left = merge_before(src, keys, l, r, nocase);
+        winner[t] = left ? l : r;
+        tree[t] = left ? r : l;
+    }
+    tree[0] = winner[1];
+
+    /* Relink the elements in order, prev links included */
+    size_t round = 3 * k / 4, step = 0;
+    list_ele_t *tail = NULL;
+    while (src[tree[0]].count != 0) {
+        size_t w = tree[0];
+        merge_src_t *from = &src[w];
+        list_ele_t *e = from->ele[from->first];
+        from->first = (from->first + 1) & (MERGE_AHEAD - 1);
+        from->count--;
+        if (++step == round) {
+            step = 0;
+            for (size_t i = 0; i < k; i++)
+                if (src[i].count < MERGE_AHEAD && src[i].next != NULL)
+                    merge_look(&src[i], nocase);
+        }
+        if (from->count == 0 && from->next != NULL)
+            merge_look(from, nocase);
+        keys[w] = from->count ? from->key[from->first] : MERGE_DONE;
+
+        e->prev = tail;
+        if (tail != NULL)
+            tail->next = e;
+        else
+            dst->head = e;
+        tail = e;
+        merge_adjust(tree, src, keys, k, w, nocase);
+    }
+    if (tail != NULL)
+        tail->next = NULL;
+    dst->tail = tail;
+    for (size_t i = 1; i < k; i++)
+        qs[i]->size = 0;
+
+    free(tree);
+    free(src);
+    free(keys);
+    return true;
 }
@@ -5,30 +5,236 @@
  * This program implements a queue supporting both FIFO and LIFO
  * operations.
  *
- * It uses a singly-linked list to represent the set of queue elements
+ * By default it uses a singly-linked list to represent the set of queue
+ * elements.  Alternative representations are selected at compile time:
+ *   QUEUE_UNROLLED - unrolled linked list, see queue_unrolled.c
+ *   QUEUE_RING     - growable circular array, see queue_ring.c
  */
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* Data structure declarations */
 
-/* Linked list element (You shouldn't need to change this) */
+#if defined(QUEUE_UNROLLED)
+
+/* Number of strings held by every node of the unrolled list */
+#define QNODE_CAPACITY 32
+
+/* Node of the unrolled list, holding a run of consecutive strings */
+typedef struct QNODE {
+    struct QNODE *next, *prev;
+    int head, tail; /* Occupied slots are value[head] to value[tail - 1] */
+    char *value[QNODE_CAPACITY];
+} qnode_t;
+
+/* Queue structure */
+typedef struct {
+    qnode_t *head; /* Unrolled list of nodes, none of them empty */
+    qnode_t *tail;
+    int size;
+    qnode_t *spare; /* Emptied node kept for reuse */
+} queue_t;
+
+/* Position of a string within the queue */
+typedef struct {
+    qnode_t *node;
+    int index;
+} q_iter_t;
+
+static inline q_iter_t q_iter_begin(queue_t *q)
+{
+    q_iter_t it = {q ? q->head : NULL, q && q->head ? q->head->head : 0};
+    return it;
+}
+
+static inline bool q_iter_valid(q_iter_t *it)
+{
+    return it->node != NULL;
+}
+
+static inline char *q_iter_value(q_iter_t *it)
+{
+    return it->node->value[it->index];
+}
+
+static inline void q_iter_next(q_iter_t *it)
+{
+    if (++it->index == it->node->tail) {
+        it->node = it->node->next;
+        it->index = it->node ? it->node->head : 0;
+    }
+}
+
+static inline q_iter_t q_iter_last(queue_t *q)
+{
+    q_iter_t it = {q ? q->tail : NULL, q && q->tail ? q->tail->tail - 1 : 0};
+    return it;
+}
+
+static inline char *q_peek_head(queue_t *q)
+{
+    return q && q->head ? q->head->value[q->head->head] : NULL;
+}
+
+static inline char *q_peek_tail(queue_t *q)
+{
+    return q && q->tail ? q->tail->value[q->tail->tail - 1] : NULL;
+}
+
+#elif defined(QUEUE_RING)
+
+/* Queue structure */
+typedef struct {
+    char **buf;  /* Circular array of strings, its capacity a power of two */
+    size_t mask; /* Capacity minus one */
+    size_t head; /* Slot of the first string */
+    int size;
+} queue_t;
+
+/* Position of a string within the queue */
+typedef struct {
+    queue_t *q;
+    int index;
+} q_iter_t;
+
+static inline q_iter_t q_iter_begin(queue_t *q)
+{
+    q_iter_t it = {q, 0};
+    return it;
+}
+
+static inline bool q_iter_valid(q_iter_t *it)
+{
+    return it->q != NULL && it->index < it->q->size;
+}
+
+static inline char *q_iter_value(q_iter_t *it)
+{
+    return it->q->buf[(it->q->head + it->index) & it->q->mask];
+}
+
+static inline void q_iter_next(q_iter_t *it)
+{
+    it->index++;
+}
+
+static inline q_iter_t q_iter_last(queue_t *q)
+{
+    q_iter_t it = {q && q->size ? q : NULL, q ? q->size - 1 : 0};
+    return it;
+}
+
+static inline char *q_peek_head(queue_t *q)
+{
+    return q && q->size ? q->buf[q->head] : NULL;
+}
+
+static inline char *q_peek_tail(queue_t *q)
+{
+    return q && q->size ? q->buf[(q->head + q->size - 1) & q->mask] : NULL;
+}
+
+#else /* linked list */
+
+/* The elements are stable, see the operations at the end of this file */
+#define QUEUE_LIST
+
+/*
+ * Doubly-linked list element.
+ * A pointer to an element is a handle on it: it stays valid, whatever else
+ * happens to the queue, until the element itself is removed.
+ */
 typedef struct ELE {
     /* Pointer to array holding string.
-     * This array needs to be explicitly allocated and freed
+     * It points at the inline storage at the end of the element, so the
+     * element and its string are allocated and freed as a single block
      */
     char *value;
     struct ELE *next;
+    struct ELE *prev;
+#ifdef QUEUE_SORT_KEY
+    /* Sort key: the first 8 bytes of the string, padded with zeros and
+     * packed most significant first, so that comparing keys compares those
+     * bytes.  Most comparisons are settled by the keys alone.  Without
+     * QUEUE_SORT_KEY, the sorts derive it from the string when needed.
+     */
+    uint64_t key;
+    uint32_t len; /* Length of the string */
+#endif
+    char str[];   /* Copy of the string, stored right after the element */
 } list_ele_t;
 
 /* Queue structure */
-typedef struct {
+typedef struct QUEUE {
     list_ele_t *head; /* Linked list of elements */
     list_ele_t *tail;
     int size;
+    struct ARENA *arena;        /* Memory the elements are carved from */
+    struct QUEUE *sibling;      /* Next queue sharing the arena, circularly */
+    void *sort_buf;             /* Space for q_sort, see q_sort_prepare */
+    size_t sort_cap;            /* Bytes it holds */
 } queue_t;
 
+/* Position of a string within the queue */
+typedef struct {
+    list_ele_t *ele;
+} q_iter_t;
+
+static inline q_iter_t q_iter_begin(queue_t *q)
+{
+    q_iter_t it = {q ? q->head : NULL};
+    return it;
+}
+
+static inline bool q_iter_valid(q_iter_t *it)
+{
+    return it->ele != NULL;
+}
+
+static inline char *q_iter_value(q_iter_t *it)
+{
+    return it->ele->value;
+}
+
+static inline void q_iter_next(q_iter_t *it)
+{
+    it->ele = it->ele->next;
+}
+
+static inline q_iter_t q_iter_last(queue_t *q)
+{
+    q_iter_t it = {q ? q->tail : NULL};
+    return it;
+}
+
+static inline char *q_peek_head(queue_t *q)
+{
+    return q && q->head ? q->head->value : NULL;
+}
+
+static inline char *q_peek_tail(queue_t *q)
+{
+    return q && q->tail ? q->tail->value : NULL;
+}
+
+#endif
+
+/*
+ * The helpers above let the test harness inspect a queue without knowing
+ * its representation.  q_peek_head and q_peek_tail return the string at
+ * either end, or NULL if q is NULL or empty.  A queue is traversed with
+ *
+ *     for (q_iter_t it = q_iter_begin(q); q_iter_valid(&it);
+ *          q_iter_next(&it))
+ *         use(q_iter_value(&it));
+ *
+ * q_iter_last positions an iterator on the last string instead.  It stays
+ * valid across insertions at the tail, after which q_iter_next reaches the
+ * new strings.
+ */
+
 /* Operations on queue */
 
 /*
@@ -61,6 +267,22 @@ bool q_insert_head(queue_t *q, char *s);
  */
 bool q_insert_tail(queue_t *q, char *s);
 
+/*
+ * Attempt to insert the n strings of array strs at head of queue, with the
+ * same result as calling q_insert_head on each of them in turn.
+ * Return the number of strings inserted.  It is less than n only if q is
+ * NULL or could not allocate space, in which case the strings strs[0] up to
+ * the returned count are the ones inserted.
+ */
+size_t q_insert_head_bulk(queue_t *q, char **strs, size_t n);
+
+/*
+ * Attempt to insert the n strings of array strs at tail of queue, with the
+ * same result as calling q_insert_tail on each of them in turn.
+ * Return value as for q_insert_head_bulk.
+ */
+size_t q_insert_tail_bulk(queue_t *q, char **strs, size_t n);
+
 /*
  * Attempt to remove element from head of queue.
  * Return true if successful.
@@ -71,6 +293,27 @@ bool q_insert_tail(queue_t *q, char *s);
  */
 bool q_remove_head(queue_t *q, char *sp, size_t bufsize);
 
+/*
+ * Attempt to remove element from tail of queue.
+ * Other than the end it removes from, same as q_remove_head.
+ */
+bool q_remove_tail(queue_t *q, char *sp, size_t bufsize);
+
+/*
+ * Attempt to remove up to n elements from head of queue.
+ * Return the number of elements removed, 0 if q is NULL or empty.
+ * If buf is non-NULL, the removed strings are copied into it back to back,
+ * each followed by a null terminator, and offsets[i] (if offsets is
+ * non-NULL) receives the position in buf of the i-th string.  Removal stops
+ * before a string that would not fit in the bufsize bytes of buf, except
+ * for the first one, which is truncated as q_remove_head does.
+ */
+size_t q_remove_head_bulk(queue_t *q,
+                          size_t n,
+                          char *buf,
+                          size_t bufsize,
+                          size_t *offsets);
+
 /*
  * Return number of elements in queue.
  * Return 0 if q is NULL or empty
@@ -93,4 +336,140 @@ void q_reverse(queue_t *q);
  */
 void q_sort(queue_t *q);
 
+/* Flags of q_sort_ex, ascending and case sensitive if none is given */
+enum {
+    Q_SORT_DESC = 1,   /* Descending order */
+    Q_SORT_NOCASE = 2, /* Ignore case, as strcasecmp does */
+};
+
+/*
+ * Sort elements of queue in the order given by flags, a combination of the
+ * above.  The descending order comes from the sort itself, which takes no
+ * longer than an ascending one.  q_sort is the same as q_sort_ex with
+ * Q_SORT_NOCASE if q_sort_nocase is set, and no flag otherwise.
+ * No effect if q is NULL or empty.
+ */
+void q_sort_ex(queue_t *q, int flags);
+
+/*
+ * Move the k smallest elements of queue to its head, in ascending order as
+ * q_sort leaves them, and the others after them in no particular order.
+ * Takes O(n log k) time for n elements, rather than O(n log n).
+ * No effect if q is NULL or k is not positive.  If q has no more than k
+ * elements, same as q_sort.
+ */
+void q_sort_partial(queue_t *q, int k);
+
+/*
+ * If nonzero, q_sort orders the strings ignoring case, as strcasecmp does,
+ * rather than byte by byte as strcmp does.  Zero by default.
+ */
+extern int q_sort_nocase;
+
+/*
+ * Sort elements of queue q in ascending order, as q_sort does, with about
+ * mem_budget bytes of memory besides the queue itself, for queues that do
+ * not fit in memory twice.  The strings go through temporary files in
+ * directory tmpdir, sorted in runs and merged back into q.  A budget below
+ * 8192 bytes counts as 8192.  A write buffer of 64 KiB and the current
+ * string of each run being merged come on top of it.  See external.c.
+ * Return true if successful, or if q has fewer than two elements.
+ * Return false if q or tmpdir is NULL, or if could not allocate space or
+ * use tmpdir.  The strings spilled to tmpdir by then are merged back after
+ * those still in q, which are thus not sorted, or, if they cannot be merged,
+ * read back one file after the other.  Should inserting them back keep
+ * failing, the strings not inserted yet are lost.  However many strings
+ * spill, no more files are kept open than half the descriptors the process
+ * may have.
+ */
+bool q_sort_external(queue_t *q, const char *tmpdir, size_t mem_budget);
+
+/*
+ * Remove every element whose string equals that of the element before it,
+ * as q_sort compares them, so ignoring case if q_sort_nocase is set.  In a
+ * sorted queue, this leaves a single copy of each string.
+ * Return the number of elements removed, 0 if q is NULL.
+ * Runs of copies are freed at once where the representation allows it.
+ */
+int q_dedup(queue_t *q);
+
+/*
+ * Move all elements of queue src to the tail of queue dst, leaving src
+ * empty.  Queue src must still be freed with q_free.
+ * Return true if successful.
+ * Return false if dst or src is NULL, if they are the same queue, or if
+ * could not allocate space.
+ * No string is copied.  The linked representations relink the elements in
+ * constant time, the circular array moves the string pointers of src.
+ */
+bool q_splice_tail(queue_t *dst, queue_t *src);
+
+/*
+ * Split queue q after its first k elements.
+ * Return a new queue holding the elements that followed them, or NULL if q
+ * is NULL or could not allocate space, in which case q is left unchanged.
+ * The new queue is empty if q has no more than k elements, and must be
+ * freed with q_free like any other.
+ * The elements are moved rather than copied.
+ */
+queue_t *q_split(queue_t *q, int k);
+
+/*
+ * Merge the k queues of array qs, each sorted in ascending order as q_sort
+ * leaves it, into qs[0], leaving the others empty.  Equal strings keep the
+ * order of the queues they come from.  The queues must be distinct, and
+ * the others must still be freed with q_free.
+ * Return true if successful.
+ * Return false if qs is NULL, k is 0, any of the queues is NULL, or could
+ * not allocate space, in which case the queues are left unchanged.
+ * No string is copied, and a loser tree picks every element with about
+ * log2(k) comparisons, which makes the merge O(n log k) for n elements.
+ */
+bool q_merge_k(queue_t **qs, size_t k);
+
+#ifdef QUEUE_LIST
+
+/*
+ * Attempt to remove element e, given by its handle, from queue q.
+ * Return true if successful.
+ * Return false if q or e is NULL.  Element e must belong to queue q.
+ * If sp is non-NULL, copy the removed string to *sp as q_remove_head does.
+ * Takes constant time wherever e is in the queue.
+ */
+bool q_erase(queue_t *q, list_ele_t *e, char *sp, size_t bufsize);
+
+/* Sorting algorithms of q_sort */
+enum {
+    Q_SORT_RADIX, /* MSD radix sort, the default */
+    Q_SORT_MERGE, /* Natural merge sort, linear time on presorted input */
+    Q_SORT_MKQS,  /* Multikey quicksort of an array, see q_sort_prepare */
+    Q_SORT_BURST, /* Burstsort, for very large queues, see q_sort_prepare */
+};
+
+/* Algorithm used by q_sort, Q_SORT_RADIX unless set otherwise */
+extern int q_sort_engine;
+
+/*
+ * Number of threads q_sort may use, 1 by default.  Sorting in parallel
+ * still allocates no list element, only the threads themselves.
+ */
+extern int q_sort_threads;
+
+/*
+ * Allocate the space q_sort needs beyond the elements of q, since q_sort
+ * itself allocates nothing.  Q_SORT_MKQS needs an array with 16 bytes per
+ * element, Q_SORT_BURST the nodes of a trie, about 12 bytes per element:
+ * two nodes of 6KB for every 1024 elements.
+ * Call it before q_sort, and q_sort_finish once done sorting to free the
+ * space.  Without it, or should q grow in between, q_sort uses
+ * Q_SORT_RADIX instead.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_sort_prepare(queue_t *q);
+
+/* Free the space allocated by q_sort_prepare.  No effect if q is NULL */
+void q_sort_finish(queue_t *q);
+
+#endif /* QUEUE_LIST */
+
 #endif /* LAB0_QUEUE_H */
@@ -0,0 +1,692 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "queue.h"
+#include "strcmp_simd.h"
+
+/*
+ * Queue implemented as a circular array of string pointers.
+ *
+ * The string at position i of the queue lives in buf[(head + i) & mask].
+ * The capacity is a power of two and doubles whenever the array is full,
+ * which makes both insertions amortized constant time.  The array is
+ * allocated in q_new already, so inserting into a new queue does not need
+ * to allocate more than the copy of the string.
+ */
+
+/* Capacity of the array allocated by q_new */
+#define RING_MIN 16
+
+/* Small ranges are sorted by insertion sort */
+#define INSERTION_CUTOFF 16
+
+int q_sort_nocase = 0;
+
+#define SLOT(q, i) ((q)->buf[((q)->head + (i)) & (q)->mask])
+
+/*
+ * Make room for at least n more strings, doubling the capacity as many times
+ * as needed and moving the strings to the front of the new array.
+ * Return false if could not allocate space.
+ */
+static bool ring_reserve(queue_t *q, size_t n)
+{
+    size_t capacity = q->mask + 1;
+    if (q->size + n <= capacity)
+        return true;
+    while (q->size + n > capacity)
+        capacity *= 2;
+    char **buf = malloc(capacity * sizeof(char *));
+    if (buf == NULL)
+        return false;
+    for (int i = 0; i < q->size; i++)
+        buf[i] = SLOT(q, i);
+    free(q->buf);
+    q->buf = buf;
+    q->mask = capacity - 1;
+    q->head = 0;
+    return true;
+}
+
+/*
+ * Create empty queue.
+ * Return NULL if could not allocate space.
+ */
+queue_t *q_new()
+{
+    queue_t *q = malloc(sizeof(queue_t));
+    if (q == NULL)
+        return NULL;
+    q->buf = malloc(RING_MIN * sizeof(char *));
+    if (q->buf == NULL) {
+        free(q);
+        return NULL;
+    }
+    q->mask = RING_MIN - 1;
+    q->head = 0;
+    q->size = 0;
+    return q;
+}
+
+/* Free all storage used by queue */
+void q_free(queue_t *q)
+{
+    /* No effect if q is NULL */
+    if (q == NULL)
+        return;
+    /* Free the strings and the array holding them */
+    for (int i = 0; i < q->size; i++)
+        free(SLOT(q, i));
+    free(q->buf);
+    /* Free queue structure */
+    free(q);
+}
+
+/*
+ * Attempt to insert element at head of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_head(queue_t *q, char *s)
+{
+    if (q == NULL)
+        return false;
+    if (!ring_reserve(q, 1))
+        return false;
+    char *value = strdup(s);
+    if (value == NULL)
+        return false;
+    q->head = (q->head - 1) & q->mask;
+    q->buf[q->head] = value;
+    q->size++;
+    return true;
+}
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_tail(queue_t *q, char *s)
+{
+    if (q == NULL)
+        return false;
+    if (!ring_reserve(q, 1))
+        return false;
+    char *value = strdup(s);
+    if (value == NULL)
+        return false;
+    SLOT(q, q->size) = value;
+    q->size++;
+    return true;
+}
+
+/*
+ * Attempt to insert the n strings of array strs at head of queue, with the
+ * same result as calling q_insert_head on each of them in turn.
+ * Return the number of strings inserted.
+ */
+size_t q_insert_head_bulk(queue_t *q, char **strs, size_t n)
+{
+    if (q == NULL || !ring_reserve(q, n))
+        return 0;
+    size_t cnt = 0;
+    for (; cnt < n; cnt++) {
+        char *value = strdup(strs[cnt]);
+        if (value == NULL)
+            break;
+        q->head = (q->head - 1) & q->mask;
+        q->buf[q->head] = value;
+    }
+    q->size += cnt;
+    return cnt;
+}
+
+/*
+ * Attempt to insert the n strings of array strs at tail of queue, with the
+ * same result as calling q_insert_tail on each of them in turn.
+ * Return the number of strings inserted.
+ */
+size_t q_insert_tail_bulk(queue_t *q, char **strs, size_t n)
+{
+    if (q == NULL || !ring_reserve(q, n))
+        return 0;
+    size_t cnt = 0;
+    for (; cnt < n; cnt++) {
+        char *value = strdup(strs[cnt]);
+        if (value == NULL)
+            break;
+        SLOT(q, q->size + cnt) = value;
+    }
+    q->size += cnt;
+    return cnt;
+}
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return true if successful.
+ * Return false if queue is NULL or empty.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ * The space used by the list element and the string should be freed.
+ */
+bool q_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    if (q == NULL || q->size == 0)
+        return false;
+    char *value = q->buf[q->head];
+    if (sp != NULL) {
+        size_t length = strlen(value);
+        length = (bufsize - 1 >= length) ? length : bufsize - 1;
+        strncpy(sp, value, length);
+        *(sp + length) = '\0';
+    }
+    free(value);
+    q->head = (q->head + 1) & q->mask;
+    q->size--;
+    return true;
+}
+
+/*
+ * Attempt to remove up to n elements from head of queue, copying their
+ * strings back to back into buf if it is non-NULL.
+ * Return the number of elements removed.
+ */
+size_t q_remove_head_bulk(queue_t *q,
+                          size_t n,
+                          char *buf,
+                          size_t bufsize,
+                          size_t *offsets)
+{
+    if (q == NULL)
+        return 0;
+
+    size_t cnt = 0, used = 0;
+    for (; q->size > 0 && cnt < n; cnt++) {
+        char *value = q->buf[q->head];
+        if (buf != NULL) {
+            size_t length = strlen(value);
+            if (used + length + 1 > bufsize) {
+                if (cnt > 0 || bufsize == 0)
+                    break;
+                length = bufsize - 1;
+            }
+            memcpy(buf + used, value, length);
+            buf[used + length] = '\0';
+            if (offsets != NULL)
+                offsets[cnt] = used;
+            used += length + 1;
+        }
+        free(value);
+        q->head = (q->head + 1) & q->mask;
+        q->size--;
+    }
+    return cnt;
+}
+
+/*
+ * Attempt to remove element from tail of queue.
+ * Other than the end it removes from, same as q_remove_head.
+ */
+bool q_remove_tail(queue_t *q, char *sp, size_t bufsize)
+{
+    if (q == NULL || q->size == 0)
+        return false;
+    char *value = SLOT(q, q->size - 1);
+    if (sp != NULL) {
+        size_t length = strlen(value);
+        length = (bufsize - 1 >= length) ? length : bufsize - 1;
+        strncpy(sp, value, length);
+        *(sp + length) = '\0';
+    }
+    free(value);
+    q->size--;
+    return true;
+}
+
+/*
+ * Return number of elements in queue.
+ * Return 0 if q is NULL or empty
+ */
+int q_size(queue_t *q)
+{
+    if (q == NULL)
+        return 0;
+    else
+        return q->size;
+}
+
+static inline void swap(char **a, char **b)
+{
+    char *tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/*
+ * Reverse elements in queue
+ * No effect if q is NULL or empty
+ * This function should not allocate or free any list elements
+ * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
+ * It should rearrange the existing ones.
+ */
+void q_reverse(queue_t *q)
+{
+    if (q == NULL || q->size == 0)
+        return;
+    for (int i = 0, j = q->size - 1; i < j; i++, j--)
+        swap(&SLOT(q, i), &SLOT(q, j));
+}
+
+static void reverse_range(char **a, size_t n)
+{
+    for (size_t i = 0, j = n - 1; i < j; i++, j--)
+        swap(&a[i], &a[j]);
+}
+
+/* Order of strings a and b for sorting with the flags of q_sort_ex */
+static inline int order(const char *a, const char *b, int flags)
+{
+    int c = flags & Q_SORT_NOCASE ? str_casecmp(a, b) : str_cmp(a, b);
+    return flags & Q_SORT_DESC ? -c : c;
+}
+
+/* Order of strings a and b for sorting, see q_sort_nocase */
+static inline int compare(const char *a, const char *b)
+{
+    return q_sort_nocase ? str_casecmp(a, b) : str_cmp(a, b);
+}
+
+static inline void insertion_sort(char **a, int n, int flags)
+{
+    for (int i = 1; i < n; i++) {
+        char *value = a[i];
+        int j = i;
+        for (; j > 0 && order(a[j - 1], value, flags) > 0; j--)
+            a[j] = a[j - 1];
+        a[j] = value;
+    }
+}
+
+/*
+ * Partition n strings around a pivot, the median of the first, middle and
+ * last strings.  Hoare partitioning keeps runs of equal strings balanced.
+ * Return j such that strings 0 to j are no greater than the pivot, and the
+ * rest no less.  Return n - 1 if the strings are all equal, which leaves
+ * nothing to sort; a partition never returns it otherwise.  Always inlined,
+ * so that a quicksort compiles it for its own flags.
+ */
+static inline __attribute__((always_inline)) int
+partition(char **a, int n, int flags)
+{
+    int m = (n - 1) / 2;
+    if (order(a[0], a[m], flags) > 0)
+        swap(&a[0], &a[m]);
+    if (order(a[m], a[n - 1], flags) > 0) {
+        swap(&a[m], &a[n - 1]);
+        if (order(a[0], a[m], flags) > 0)
+            swap(&a[0], &a[m]);
+    }
+    char *pivot = a[m];
+
+    /* The ends being equal, so are likely all strings in between */
+    if (order(a[0], a[n - 1], flags) == 0) {
+        int i = 1;
+        while (i < n - 1 && order(a[i], pivot, flags) == 0)
+            i++;
+        if (i == n - 1)
+            return n - 1;
+    }
+
+    int i = 0, j = n - 1;
+    for (;;) {
+        while (order(a[i], pivot, flags) < 0)
+            i++;
+        while (order(a[j], pivot, flags) > 0)
+            j--;
+        if (i >= j)
+            return j;
+        swap(&a[i], &a[j]);
+        i++;
+        j--;
+    }
+}
+
+/*
+ * Sort n strings with quicksort.  Only the smaller part is sorted
+ * recursively, which bounds the recursion depth by log2(n).  There is one
+ * such function per combination of the flags of q_sort_ex, the flags being
+ * constant in each so that its comparisons are compiled for them.
+ */
+#define QUICKSORT(name, flags)                  \
+    static void name(char **a, int n)           \
+    {                                           \
+        while (n > INSERTION_CUTOFF) {          \
+            int j = partition(a, n, flags);     \
+            if (j == n - 1)                     \
+                return;                         \
+            if (j + 1 < n - j - 1) {            \
+                name(a, j + 1);                 \
+                a += j + 1;                     \
+                n = n - j - 1;                  \
+            } else {                            \
+                name(a + j + 1, n - j - 1);     \
+                n = j + 1;                      \
+            }                                   \
+        }                                       \
+        insertion_sort(a, n, flags);            \
+    }
+
+QUICKSORT(quicksort_asc, 0)
+QUICKSORT(quicksort_desc, Q_SORT_DESC)
+QUICKSORT(quicksort_asc_nocase, Q_SORT_NOCASE)
+QUICKSORT(quicksort_desc_nocase, Q_SORT_DESC | Q_SORT_NOCASE)
+
+static void quicksort(char **a, int n, int flags)
+{
+    switch (flags & (Q_SORT_DESC | Q_SORT_NOCASE)) {
+    case 0:
+        quicksort_asc(a, n);
+        break;
+    case Q_SORT_DESC:
+        quicksort_desc(a, n);
+        break;
+    case Q_SORT_NOCASE:
+        quicksort_asc_nocase(a, n);
+        break;
+    default:
+        quicksort_desc_nocase(a, n);
+        break;
+    }
+}
+
+/*
+ * Move the k smallest of n strings to the front, sorted.  A part wholly
+ * beyond the first k strings is left as partitioned, so this takes about
+ * linear time plus that of sorting k strings.
+ */
+static void partial_quicksort(char **a, int n, int k, int flags)
+{
+    while (n > INSERTION_CUTOFF && k > 0) {
+        int j = partition(a, n, flags);
+        if (j == n - 1)
+            return;
+        if (j + 1 >= k) {
+            n = j + 1;
+        } else {
+            quicksort(a, j + 1, flags);
+            a += j + 1;
+            n = n - j - 1;
+            k -= j + 1;
+        }
+    }
+    if (k > 0)
+        insertion_sort(a, n, flags);
+}
+
+/*
+ * Rotate the whole array so the strings start at slot 0, which makes them
+ * contiguous.  Three reversals do it in place.
+ */
+static void rotate_to_start(queue_t *q)
+{
+    if (q->head != 0) {
+        size_t capacity = q->mask + 1;
+        reverse_range(q->buf, q->head);
+        reverse_range(q->buf + q->head, capacity - q->head);
+        reverse_range(q->buf, capacity);
+        q->head = 0;
+    }
+}
+
+/*
+ * Sort elements of queue in the order given by flags, see q_sort_ex
+ * No effect if q is NULL or empty. In addition, if q has only one
+ * element, do nothing.
+ */
+void q_sort_ex(queue_t *q, int flags)
+{
+    if (q == NULL || q->size == 0)
+        return;
+    if (q->size == 1) {
+        /* no-op */
+        return;
+    }
+    rotate_to_start(q);
+    quicksort(q->buf, q->size, flags);
+}
+
+/*
+ * Sort elements of queue in ascending order
+ */
+void q_sort(queue_t *q)
+{
+    q_sort_ex(q, q_sort_nocase ? Q_SORT_NOCASE : 0);
+}
+
+/*
+ * Move the k smallest elements of queue to its head, sorted, the others
+ * after them in no particular order
+ */
+void q_sort_partial(queue_t *q, int k)
+{
+    if (q == NULL || k <= 0)
+        return;
+    if (k >= q->size) {
+        q_sort(q);
+        return;
+    }
+    rotate_to_start(q);
+    partial_quicksort(q->buf, q->size, k, q_sort_nocase ? Q_SORT_NOCASE : 0);
+}
+
+/*
+ * Remove the elements equal to the one before them, compacting the array
+ * in a single pass
+ */
+int q_dedup(queue_t *q)
+{
+    if (q == NULL || q->size == 0)
+        return 0;
+    int kept = 1;
+    for (int i = 1; i < q->size; i++) {
+        char *s = SLOT(q, i);
+        if (compare(SLOT(q, kept - 1), s) == 0)
+            free(s);
+        else
+            SLOT(q, kept++) = s;
+    }
+    int removed = q->size - kept;
+    q->size = kept;
+    return removed;
+}
+
+/*
+ * Move all elements of queue src to the tail of queue dst, leaving src
+ * empty.
+ * Return true if successful.
+ * Return false if dst or src is NULL, if they are the same queue, or if
+ * could not allocate space.
+ */
+bool q_splice_tail(queue_t *dst, queue_t *src)
+{
+    if (dst == NULL || src == NULL || dst == src)
+        return false;
+    /* The strings stay where they are, only the pointers move */
+    if (!ring_reserve(dst, src->size))
+        return false;
+    for (int i = 0; i < src->size; i++)
+        SLOT(dst, dst->size + i) = SLOT(src, i);
+    dst->size += src->size;
+    src->size = 0;
+    return true;
+}
+
+/*
+ * Split queue q after its first k elements.
+ * Return a new queue holding the elements that followed them, or NULL if q
+ * is NULL or could not allocate space.
+ */
+queue_t *q_split(queue_t *q, int k)
+{
+    if (q == NULL)
+        return NULL;
+    queue_t *r = q_new();
+    if (r == NULL)
+        return NULL;
+    if (k < 0)
+        k = 0;
+    if (k >= q->size)
+        return r;
+
+    if (!ring_reserve(r, q->size - k)) {
+        q_free(r);
+        return NULL;
+    }
+    for (int i = k; i < q->size; i++)
+        r->buf[i - k] = SLOT(q, i);
+    r->size = q->size - k;
+    q->size = k;
+    return r;
+}
+
+/*
+ * The merge of q_merge_k picks the next string among the first ones left in
+ * the queues with a loser tree.  Node t of the tree, for t from 1 to k - 1,
+ * holds the queue that lost the match played there, and node 0 the overall
+ * winner, so replacing the winner's string takes a single match per level.
+ * Each queue has the key of its first string at hand, which settles most
+ * matches without reaching the strings.
+ */
+
+/* Queue that wins every match, which fills a loser tree from the bottom */
+#define MERGE_FIRST SIZE_MAX
+
+typedef struct {
+    queue_t *q;
+    int pos;      /* Position of the next string, q->size once exhausted */
+    uint64_t key; /* Its first 8 bytes, see merge_key */
+} merge_src_t;
+
+/*
+ * First 8 bytes of s, padded with zeros and packed most significant first,
+ * in lower case if q_sort_nocase is set.  Comparing keys compares those
+ * bytes as compare does.
+ */
+static inline uint64_t merge_key(const char *s)
+{
+    uint64_t key = 0;
+    for (int i = 0; i < 8; i++) {
+        unsigned char c = *s;
+        if (q_sort_nocase && c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        key = key << 8 | c;
+        if (c != '\0')
+            s++;
+    }
+    return key;
+}
+
+/* Move source m to its next string, and have the one after fetched */
+static inline void merge_next(merge_src_t *m)
+{
+    if (++m->pos == m->q->size)
+        return;
+    m->key = merge_key(SLOT(m->q, m->pos));
+    if (m->pos + 1 < m->q->size)
+        __builtin_prefetch(SLOT(m->q, m->pos + 1));
+}
+
+/*
+ * Does queue a come before queue b?  Exhausted queues come last, and ties
+ * go to the lower queue.
+ */
+static inline bool merge_before(merge_src_t *src, size_t a, size_t b)
+{
+    if (a == MERGE_FIRST || b == MERGE_FIRST)
+        return a == MERGE_FIRST;
+    merge_src_t *x = &src[a], *y = &src[b];
+    if (x->pos == x->q->size || y->pos == y->q->size)
+        return y->pos == y->q->size;
+    if (x->key != y->key)
+        return x->key < y->key;
+    int c = compare(SLOT(x->q, x->pos), SLOT(y->q, y->pos));
+    return c < 0 || (c == 0 && a < b);
+}
+
+/* Replay the matches of queue s up the tree, leaving the winner in tree[0] */
+static void merge_adjust(size_t *tree, merge_src_t *src, size_t k, size_t s)
+{
+    for (size_t t = (s + k) / 2; t > 0; t /= 2) {
+        if (merge_before(src, tree[t], s)) {
+            size_t winner = tree[t];
+            tree[t] = s;
+            s = winner;
+        }
+    }
+    tree[0] = s;
+}
+
+/*
+ * Merge the k sorted queues of qs into qs[0], leaving the others empty
+ */
+bool q_merge_k(queue_t **qs, size_t k)
+{
+    if (qs == NULL || k == 0)
+        return false;
+    size_t size = 0;
+    for (size_t i = 0; i < k; i++) {
+        if (qs[i] == NULL)
+            return false;
+        size += qs[i]->size;
+    }
+    if (k == 1)
+        return true;
+
+    /* The pointers are merged into a new array, the strings stay put */
+    queue_t *dst = qs[0];
+    size_t capacity = dst->mask + 1;
+    while (size > capacity)
+        capacity *= 2;
+    char **buf = malloc(capacity * sizeof(char *));
+    size_t *tree = malloc(k * sizeof(size_t));
+    merge_src_t *src = malloc(k * sizeof(merge_src_t));
+    if (buf == NULL || tree == NULL || src == NULL) {
+        free(buf);
+        free(tree);
+        free(src);
+        return false;
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        src[i] = (merge_src_t){qs[i], -1, 0};
+        merge_next(&src[i]);
+        tree[i] = MERGE_FIRST;
+    }
+    for (size_t i = k; i-- > 0;)
+        merge_adjust(tree, src, k, i);
+    for (size_t n = 0; n < size; n++) {
+        size_t w = tree[0];
+        buf[n] = SLOT(qs[w], src[w].pos);
+        merge_next(&src[w]);
+        merge_adjust(tree, src, k, w);
+    }
+
+    free(dst->buf);
+    dst->buf = buf;
+    dst->mask = capacity - 1;
+    dst->head = 0;
+    dst->size = size;
+    for (size_t i = 1; i < k; i++)
+        qs[i]->size = 0;
+
+    free(tree);
+    free(src);
+    return true;
+}
@@ -0,0 +1,977 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "queue.h"
+#include "strcmp_simd.h"
+
+/*
+ * Queue implemented as an unrolled linked list.
+ *
+ * Every node holds up to QNODE_CAPACITY string pointers in an array, so
+ * walking the queue follows one node pointer per QNODE_CAPACITY strings
+ * instead of one per string.  A node never stays empty in the list: the
+ * last string removed from it sends the node to the spare slot of the
+ * queue, from which the next new node is taken.
+ */
+
+/* Small ranges are sorted by insertion sort */
+#define INSERTION_CUTOFF 16
+
+int q_sort_nocase = 0;
+
+/* Get an empty node, either the spare one or a newly allocated one */
+static qnode_t *node_get(queue_t *q)
+{
+    qnode_t *n = q->spare;
+    if (n != NULL)
+        q->spare = NULL;
+    else
+        n = malloc(sizeof(qnode_t));
+    return n;
+}
+
+/* Keep an empty node out of the queue as the spare one, or free it */
+static void node_drop(queue_t *q, qnode_t *n)
+{
+    if (q->spare == NULL)
+        q->spare = n;
+    else
+        free(n);
+}
+
+/* Unlink an emptied node from the queue and keep or free it */
+static void node_put(queue_t *q, qnode_t *n)
+{
+    if (n->prev)
+        n->prev->next = n->next;
+    else
+        q->head = n->next;
+    if (n->next)
+        n->next->prev = n->prev;
+    else
+        q->tail = n->prev;
+    node_drop(q, n);
+}
+
+/*
+ * Create empty queue.
+ * Return NULL if could not allocate space.
+ */
+queue_t *q_new()
+{
+    queue_t *q = malloc(sizeof(queue_t));
+    if (q != NULL) {
+        q->head = NULL;
+        q->tail = NULL;
+        q->size = 0;
+        q->spare = NULL;
+    }
+    return q; /* If malloc returned NULL, this function returns NULL */
+}
+
+/* Free all storage used by queue */
+void q_free(queue_t *q)
+{
+    /* No effect if q is NULL */
+    if (q == NULL)
+        return;
+    /* Free the strings and the nodes holding them */
+    while (q->head) {
+        qnode_t *target = q->head;
+        q->head = target->next;
+        for (int i = target->head; i < target->tail; i++)
+            free(target->value[i]);
+        free(target);
+    }
+    free(q->spare);
+    /* Free queue structure */
+    free(q);
+}
+
+/*
+ * Attempt to insert element at head of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_head(queue_t *q, char *s)
+{
+    if (q == NULL)
+        return false;
+    char *value = strdup(s);
+    if (value == NULL)
+        return false;
+
+    qnode_t *n = q->head;
+    if (n == NULL || n->head == 0) {
+        /* No room left in front, put a new node before the head */
+        n = node_get(q);
+        if (n == NULL) {
+            free(value);
+            return false;
+        }
+        n->head = n->tail = QNODE_CAPACITY;
+        n->prev = NULL;
+        n->next = q->head;
+        if (q->head)
+            q->head->prev = n;
+        else
+            q->tail = n;
+        q->head = n;
+    }
+    n->value[--n->head] = value;
+    q->size++;
+    return true;
+}
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_tail(queue_t *q, char *s)
+{
+    if (q == NULL)
+        return false;
+    char *value = strdup(s);
+    if (value == NULL)
+        return false;
+
+    qnode_t *n = q->tail;
+    if (n == NULL || n->tail == QNODE_CAPACITY) {
+        /* No room left behind, put a new node after the tail */
+        n = node_get(q);
+        if (n == NULL) {
+            free(value);
+            return false;
+        }
+        n->head = n->tail = 0;
+        n->next = NULL;
+        n->prev = q->tail;
+        if (q->tail)
+            q->tail->next = n;
+        else
+            q->head = n;
+        q->tail = n;
+    }
+    n->value[n->tail++] = value;
+    q->size++;
+    return true;
+}
+
+/*
+ * Attempt to insert the n strings of array strs at head of queue, with the
+ * same result as calling q_insert_head on each of them in turn.
+ * Return the number of strings inserted.
+ *
+ * The free slots in front of the head node are filled first.  The other
+ * strings go into new nodes, each filled whole from back to front, which
+ * are chained apart from the queue and put in front of it at once.
+ */
+size_t q_insert_head_bulk(queue_t *q, char **strs, size_t n)
+{
+    if (q == NULL)
+        return 0;
+    size_t cnt = 0;
+    qnode_t *h = q->head;
+    bool failed = false;
+    for (; h != NULL && h->head > 0 && cnt < n; cnt++) {
+        char *value = strdup(strs[cnt]);
+        if (value == NULL) {
+            failed = true;
+            break;
+        }
+        h->value[--h->head] = value;
+    }
+
+    /* New nodes, first the one right before the head */
+    qnode_t *first = NULL, *last = NULL;
+    while (cnt < n && !failed) {
+        qnode_t *node = node_get(q);
+        if (node == NULL)
+            break;
+        node->head = node->tail = QNODE_CAPACITY;
+        for (; node->head > 0 && cnt < n; cnt++) {
+            char *value = strdup(strs[cnt]);
+            if (value == NULL) {
+                failed = true;
+                break;
+            }
+            node->value[--node->head] = value;
+        }
+        if (node->head == QNODE_CAPACITY) {
+            node_drop(q, node);
+            break;
+        }
+        node->prev = NULL;
+        node->next = last;
+        if (last)
+            last->prev = node;
+        else
+            first = node;
+        last = node;
+    }
+
+    if (last != NULL) {
+        first->next = q->head;
+        if (q->head)
+            q->head->prev = first;
+        else
+            q->tail = first;
+        q->head = last;
+    }
+    q->size += cnt;
+    return cnt;
+}
+
+/*
+ * Attempt to insert the n strings of array strs at tail of queue, with the
+ * same result as calling q_insert_tail on each of them in turn.
+ * Return the number of strings inserted.
+ *
+ * The free slots behind the tail node are filled first.  The other strings
+ * go into new nodes, each filled whole, which are chained apart from the
+ * queue and put behind it at once.
+ */
+size_t q_insert_tail_bulk(queue_t *q, char **strs, size_t n)
+{
+    if (q == NULL)
+        return 0;
+    size_t cnt = 0;
+    qnode_t *t = q->tail;
+    bool failed = false;
+    for (; t != NULL && t->tail < QNODE_CAPACITY && cnt < n; cnt++) {
+        char *value = strdup(strs[cnt]);
+        if (value == NULL) {
+            failed = true;
+            break;
+        }
+        t->value[t->tail++] = value;
+    }
+
+    /* New nodes, first the one right after the tail */
+    qnode_t *first = NULL, *last = NULL;
+    while (cnt < n && !failed) {
+        qnode_t *node = node_get(q);
+        if (node == NULL)
+            break;
+        node->head = node->tail = 0;
+        for (; node->tail < QNODE_CAPACITY && cnt < n; cnt++) {
+            char *value = strdup(strs[cnt]);
+            if (value == NULL) {
+                failed = true;
+                break;
+            }
+            node->value[node->tail++] = value;
+        }
+        if (node->tail == 0) {
+            node_drop(q, node);
+            break;
+        }
+        node->next = NULL;
+        node->prev = last;
+        if (last)
+            last->next = node;
+        else
+            first = node;
+        last = node;
+    }
+
+    if (first != NULL) {
+        first->prev = q->tail;
+        if (q->tail)
+            q->tail->next = first;
+        else
+            q->head = first;
+        q->tail = last;
+    }
+    q->size += cnt;
+    return cnt;
+}
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return true if successful.
+ * Return false if queue is NULL or empty.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ * The space used by the list element and the string should be freed.
+ */
+bool q_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    if (q == NULL || q->head == NULL)
+        return false;
+    qnode_t *n = q->head;
+    char *value = n->value[n->head++];
+    if (sp != NULL) {
+        size_t length = strlen(value);
+        length = (bufsize - 1 >= length) ? length : bufsize - 1;
+        strncpy(sp, value, length);
+        *(sp + length) = '\0';
+    }
+    free(value);
+    if (n->head == n->tail)
+        node_put(q, n);
+    q->size--;
+    return true;
+}
+
+/*
+ * Attempt to remove up to n elements from head of queue, copying their
+ * strings back to back into buf if it is non-NULL.
+ * Return the number of elements removed.
+ */
+size_t q_remove_head_bulk(queue_t *q,
+                          size_t n,
+                          char *buf,
+                          size_t bufsize,
+                          size_t *offsets)
+{
+    if (q == NULL)
+        return 0;
+
+    size_t cnt = 0, used = 0;
+    for (; q->size > 0 && cnt < n; cnt++) {
+        char *value = q->head->value[q->head->head];
+        if (buf != NULL) {
+            size_t length = strlen(value);
+            if (used + length + 1 > bufsize) {
+                if (cnt > 0 || bufsize == 0)
+                    break;
+                length = bufsize - 1;
+            }
+            memcpy(buf + used, value, length);
+            buf[used + length] = '\0';
+            if (offsets != NULL)
+                offsets[cnt] = used;
+            used += length + 1;
+        }
+        free(value);
+        qnode_t *h = q->head;
+        if (++h->head == h->tail)
+            node_put(q, h);
+        q->size--;
+    }
+    return cnt;
+}
+
+/*
+ * Attempt to remove element from tail of queue.
+ * Other than the end it removes from, same as q_remove_head.
+ */
+bool q_remove_tail(queue_t *q, char *sp, size_t bufsize)
+{
+    if (q == NULL || q->tail == NULL)
+        return false;
+    qnode_t *n = q->tail;
+    char *value = n->value[--n->tail];
+    if (sp != NULL) {
+        size_t length = strlen(value);
+        length = (bufsize - 1 >= length) ? length : bufsize - 1;
+        strncpy(sp, value, length);
+        *(sp + length) = '\0';
+    }
+    free(value);
+    if (n->head == n->tail)
+        node_put(q, n);
+    q->size--;
+    return true;
+}
+
+/*
+ * Return number of elements in queue.
+ * Return 0 if q is NULL or empty
+ */
+int q_size(queue_t *q)
+{
+    if (q == NULL || q->head == NULL)
+        return 0;
+    else
+        return q->size;
+}
+
+/*
+ * Reverse elements in queue
+ * No effect if q is NULL or empty
+ * This function should not allocate or free any list elements
+ * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
+ * It should rearrange the existing ones.
+ */
+void q_reverse(queue_t *q)
+{
+    if (q == NULL || q->head == NULL)
+        return;
+    for (qnode_t *n = q->head; n != NULL; n = n->prev) {
+        /* Reverse the strings within the node, then the links */
+        for (int i = n->head, j = n->tail - 1; i < j; i++, j--) {
+            char *tmp = n->value[i];
+            n->value[i] = n->value[j];
+            n->value[j] = tmp;
+        }
+        qnode_t *tmp = n->next;
+        n->next = n->prev;
+        n->prev = tmp;
+    }
+    qnode_t *tmp = q->head;
+    q->head = q->tail;
+    q->tail = tmp;
+}
+
+/*
+ * Sorting works on ranges given by a cursor on their first string and their
+ * length.  Cursors move in both directions across node boundaries, which
+ * lets quicksort partition the strings in place without any allocation.
+ */
+static inline char **slot(q_iter_t *c)
+{
+    return &c->node->value[c->index];
+}
+
+static inline void cursor_next(q_iter_t *c)
+{
+    q_iter_next(c);
+}
+
+static inline void cursor_prev(q_iter_t *c)
+{
+    if (c->index == c->node->head) {
+        c->node = c->node->prev;
+        c->index = c->node->tail - 1;
+    } else {
+        c->index--;
+    }
+}
+
+/* Move cursor forward by k strings, skipping whole nodes when possible */
+static inline q_iter_t cursor_advance(q_iter_t c, int k)
+{
+    while (k >= c.node->tail - c.index) {
+        k -= c.node->tail - c.index;
+        c.node = c.node->next;
+        c.index = c.node->head;
+    }
+    c.index += k;
+    return c;
+}
+
+static inline void swap_slots(char **a, char **b)
+{
+    char *tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* Order of strings a and b for sorting with the flags of q_sort_ex */
+static inline int order(const char *a, const char *b, int flags)
+{
+    int c = flags & Q_SORT_NOCASE ? str_casecmp(a, b) : str_cmp(a, b);
+    return flags & Q_SORT_DESC ? -c : c;
+}
+
+/* Order of strings a and b for sorting, see q_sort_nocase */
+static inline int compare(const char *a, const char *b)
+{
+    return q_sort_nocase ? str_casecmp(a, b) : str_cmp(a, b);
+}
+
+static inline void insertion_sort(q_iter_t lo, int n, int flags)
+{
+    q_iter_t c = lo;
+    for (int k = 1; k < n; k++) {
+        cursor_next(&c);
+        char *value = *slot(&c);
+        q_iter_t p = c;
+        int j = k;
+        for (; j > 0; j--) {
+            q_iter_t prev = p;
+            cursor_prev(&prev);
+            if (order(*slot(&prev), value, flags) <= 0)
+                break;
+            *slot(&p) = *slot(&prev);
+            p = prev;
+        }
+        *slot(&p) = value;
+    }
+}
+
+/*
+ * Partition the n strings starting at lo around a pivot, the median of the
+ * first, middle and last strings.  Hoare partitioning keeps runs of equal
+ * strings balanced.  Return j such that strings 0 to j are no greater than
+ * the pivot, and the rest no less, and set *right to string j + 1.  Return
+ * n - 1 if the strings are all equal, which leaves nothing to sort; a
+ * partition never returns it otherwise.  Always inlined, so that a
+ * quicksort compiles it for its own flags.
+ */
+static inline __attribute__((always_inline)) int
+partition(q_iter_t lo, int n, q_iter_t *right, int flags)
+{
+    int m = (n - 1) / 2;
+    q_iter_t mid = cursor_advance(lo, m);
+    q_iter_t hi = cursor_advance(mid, n - 1 - m);
+    if (order(*slot(&lo), *slot(&mid), flags) > 0)
+        swap_slots(slot(&lo), slot(&mid));
+    if (order(*slot(&mid), *slot(&hi), flags) > 0) {
+        swap_slots(slot(&mid), slot(&hi));
+        if (order(*slot(&lo), *slot(&mid), flags) > 0)
+            swap_slots(slot(&lo), slot(&mid));
+    }
+    char *pivot = *slot(&mid);
+
+    /* The ends being equal, so are likely all strings in between */
+    if (order(*slot(&lo), *slot(&hi), flags) == 0) {
+        q_iter_t c = lo;
+        int i = 1;
+        for (cursor_next(&c); i < n - 1 && order(*slot(&c), pivot, flags) == 0;
+             cursor_next(&c))
+            i++;
+        if (i == n - 1)
+            return n - 1;
+    }
+
+    q_iter_t ci = lo, cj = hi;
+    int i = 0, j = n - 1;
+    for (;;) {
+        while (order(*slot(&ci), pivot, flags) < 0) {
+            cursor_next(&ci);
+            i++;
+        }
+        while (order(*slot(&cj), pivot, flags) > 0) {
+            cursor_prev(&cj);
+            j--;
+        }
+        if (i >= j)
+            break;
+        swap_slots(slot(&ci), slot(&cj));
+        cursor_next(&ci);
+        i++;
+        cursor_prev(&cj);
+        j--;
+    }
+    *right = cj;
+    cursor_next(right);
+    return j;
+}
+
+/*
+ * Sort the n strings starting at lo with quicksort.  Only the smaller part
+ * is sorted recursively, which bounds the recursion depth by log2(n).
+ * There is one such function per combination of the flags of q_sort_ex,
+ * the flags being constant in each so that its comparisons are compiled
+ * for them.
+ */
+#define QUICKSORT(name, flags)                                \
+    static void name(q_iter_t lo, int n)                      \
+    {                                                         \
+        while (n > INSERTION_CUTOFF) {                        \
+            q_iter_t right;                                   \
+            int j = partition(lo, n, &right, flags);          \
+            if (j == n - 1)                                   \
+                return;                                       \
+            if (j + 1 < n - j - 1) {                          \
+                name(lo, j + 1);                              \
+                lo = right;                                   \
+                n = n - j - 1;                                \
+            } else {                                          \
+                name(right, n - j - 1);                       \
+                n = j + 1;                                    \
+            }                                                 \
+        }                                                     \
+        insertion_sort(lo, n, flags);                         \
+    }
+
+QUICKSORT(quicksort_asc, 0)
+QUICKSORT(quicksort_desc, Q_SORT_DESC)
+QUICKSORT(quicksort_asc_nocase, Q_SORT_NOCASE)
+QUICKSORT(quicksort_desc_nocase, Q_SORT_DESC | Q_SORT_NOCASE)
+
+static void quicksort(q_iter_t lo, int n, int flags)
+{
+    switch (flags & (Q_SORT_DESC | Q_SORT_NOCASE)) {
+    case 0:
+        quicksort_asc(lo, n);
+        break;
+    case Q_SORT_DESC:
+        quicksort_desc(lo, n);
+        break;
+    case Q_SORT_NOCASE:
+        quicksort_asc_nocase(lo, n);
+        break;
+    default:
+        quicksort_desc_nocase(lo, n);
+        break;
+    }
+}
+
+/*
+ * Move the k smallest of the n strings starting at lo to the front, sorted.
+ * A part wholly beyond the first k strings is left as partitioned, so this
+ * takes about linear time plus that of sorting k strings.
+ */
+static void partial_quicksort(q_iter_t lo, int n, int k, int flags)
+{
+    while (n > INSERTION_CUTOFF && k > 0) {
+        q_iter_t right;
+        int j = partition(lo, n, &right, flags);
+        if (j == n - 1)
+            return;
+        if (j + 1 >= k) {
+            n = j + 1;
+        } else {
+            quicksort(lo, j + 1, flags);
+            lo = right;
+            n = n - j - 1;
+            k -= j + 1;
+        }
+    }
+    if (k > 0)
+        insertion_sort(lo, n, flags);
+}
+
+/*
+ * Sort elements of queue in the order given by flags, see q_sort_ex
+ * No effect if q is NULL or empty. In addition, if q has only one
+ * element, do nothing.
+ */
+void q_sort_ex(queue_t *q, int flags)
+{
+    if (q == NULL || q->head == NULL)
+        return;
+    if (q->size == 1) {
+        /* no-op */
+        return;
+    }
+    quicksort(q_iter_begin(q), q->size, flags);
+}
+
+/*
+ * Sort elements of queue in ascending order
+ */
+void q_sort(queue_t *q)
+{
+    q_sort_ex(q, q_sort_nocase ? Q_SORT_NOCASE : 0);
+}
+
+/*
+ * Move the k smallest elements of queue to its head, sorted, the others
+ * after them in no particular order
+ */
+void q_sort_partial(queue_t *q, int k)
+{
+    if (q == NULL || k <= 0)
+        return;
+    if (k >= q->size) {
+        q_sort(q);
+        return;
+    }
+    partial_quicksort(q_iter_begin(q), q->size, k,
+                      q_sort_nocase ? Q_SORT_NOCASE : 0);
+}
+
+/*
+ * Remove the elements equal to the one before them.  The strings kept are
+ * moved up in a single pass, and the nodes left over at the end are freed.
+ */
+int q_dedup(queue_t *q)
+{
+    if (q == NULL || q->head == NULL)
+        return 0;
+    q_iter_t last = q_iter_begin(q), c = last;
+    int removed = 0;
+    for (q_iter_next(&c); c.node != NULL; q_iter_next(&c)) {
+        char *s = *slot(&c);
+        if (compare(*slot(&last), s) == 0) {
+            free(s);
+            removed++;
+        } else {
+            cursor_next(&last);
+            *slot(&last) = s;
+        }
+    }
+
+    /* The strings end at last, drop the slots and nodes after it */
+    last.node->tail = last.index + 1;
+    qnode_t *n = last.node->next;
+    last.node->next = NULL;
+    q->tail = last.node;
+    while (n != NULL) {
+        qnode_t *next = n->next;
+        if (q->spare == NULL)
+            q->spare = n;
+        else
+            free(n);
+        n = next;
+    }
+    q->size -= removed;
+    return removed;
+}
+
+/*
+ * Move all elements of queue src to the tail of queue dst, leaving src
+ * empty.
+ * Return true if successful.
+ * Return false if dst or src is NULL, or if they are the same queue.
+ */
+bool q_splice_tail(queue_t *dst, queue_t *src)
+{
+    if (dst == NULL || src == NULL || dst == src)
+        return false;
+    if (src->head == NULL)
+        return true;
+
+    /* Nodes need not be full, so the two lists are simply linked */
+    src->head->prev = dst->tail;
+    if (dst->tail != NULL)
+        dst->tail->next = src->head;
+    else
+        dst->head = src->head;
+    dst->tail = src->tail;
+    dst->size += src->size;
+    src->head = NULL;
+    src->tail = NULL;
+    src->size = 0;
+    return true;
+}
+
+/*
+ * Split queue q after its first k elements.
+ * Return a new queue holding the elements that followed them, or NULL if q
+ * is NULL or could not allocate space.
+ */
+queue_t *q_split(queue_t *q, int k)
+{
+    if (q == NULL)
+        return NULL;
+    queue_t *r = q_new();
+    if (r == NULL)
+        return NULL;
+    if (k < 0)
+        k = 0;
+    if (k >= q->size)
+        return r;
+
+    q_iter_t c = cursor_advance(q_iter_begin(q), k);
+    qnode_t *n = c.node;
+    if (c.index != n->head) {
+        /* The split falls within node n, move its second part to a new one */
+        qnode_t *m = node_get(q);
+        if (m == NULL) {
+            q_free(r);
+            return NULL;
+        }
+        m->head = c.index;
+        m->tail = n->tail;
+        memcpy(&m->value[m->head], &n->value[m->head],
+               (m->tail - m->head) * sizeof(char *));
+        n->tail = c.index;
+        m->prev = n;
+        m->next = n->next;
+        if (n->next != NULL)
+            n->next->prev = m;
+        else
+            q->tail = m;
+        n->next = m;
+        n = m;
+    }
+
+    r->head = n;
+    r->tail = q->tail;
+    r->size = q->size - k;
+    q->tail = n->prev;
+    if (q->tail != NULL)
+        q->tail->next = NULL;
+    else
+        q->head = NULL;
+    n->prev = NULL;
+    q->size = k;
+    return r;
+}
+
+/*
+ * The merge of q_merge_k picks the next string among the first ones left in
+ * the queues with a loser tree.  Node t of the tree, for t from 1 to k - 1,
+ * holds the queue that lost the match played there, and node 0 the overall
+ * winner, so replacing the winner's string takes a single match per level.
+ * Each queue has the key of its first string at hand, which settles most
+ * matches without reaching the strings.
+ */
+
+/* Queue that wins every match, which fills a loser tree from the bottom */
+#define MERGE_FIRST SIZE_MAX
+
+typedef struct {
+    q_iter_t pos; /* Cursor on the next string, its node NULL once exhausted */
+    uint64_t key; /* Its first 8 bytes, see merge_key */
+} merge_src_t;
+
+/*
+ * First 8 bytes of s, padded with zeros and packed most significant first,
+ * in lower case if q_sort_nocase is set.  Comparing keys compares those
+ * bytes as compare does.
+ */
+static inline uint64_t merge_key(const char *s)
+{
+    uint64_t key = 0;
+    for (int i = 0; i < 8; i++) {
+        unsigned char c = *s;
+        if (q_sort_nocase && c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        key = key << 8 | c;
+        if (c != '\0')
+            s++;
+    }
+    return key;
+}
+
+/*
+ * Take the key of the string under the cursor of source m, if any, and
+ * have the next string fetched
+ */
+static inline void merge_load(merge_src_t *m)
+{
+    if (m->pos.node == NULL)
+        return;
+    m->key = merge_key(*slot(&m->pos));
+    q_iter_t ahead = m->pos;
+    q_iter_next(&ahead);
+    if (ahead.node != NULL)
+        __builtin_prefetch(*slot(&ahead));
+}
+
+/*
+ * Does queue a come before queue b?  Exhausted queues come last, and ties
+ * go to the lower queue.
+ */
+static inline bool merge_before(merge_src_t *src, size_t a, size_t b)
+{
+    if (a == MERGE_FIRST || b == MERGE_FIRST)
+        return a == MERGE_FIRST;
+    merge_src_t *x = &src[a], *y = &src[b];
+    if (x->pos.node == NULL || y->pos.node == NULL)
+        return y->pos.node == NULL;
+    if (x->key != y->key)
+        return x->key < y->key;
+    int c = compare(*slot(&x->pos), *slot(&y->pos));
+    return c < 0 || (c == 0 && a < b);
+}
+
+/* Replay the matches of queue s up the tree, leaving the winner in tree[0] */
+static void merge_adjust(size_t *tree, merge_src_t *src, size_t k, size_t s)
+{
+    for (size_t t = (s + k) / 2; t > 0; t /= 2) {
+        if (merge_before(src, tree[t], s)) {
+            size_t winner = tree[t];
+            tree[t] = s;
+            s = winner;
+        }
+    }
+    tree[0] = s;
+}
+
+/*
+ * Merge the k sorted queues of qs into qs[0], leaving the others empty.
+ *
+ * The strings are moved into new nodes, and the nodes they leave empty are
+ * used again.  Nodes hold no more than QNODE_CAPACITY strings, so after m
+ * strings the nodes emptied hold at least m - k * (QNODE_CAPACITY - 1) of
+ * them.  The merged strings never need more than k + 1 nodes beyond those,
+ * which are allocated ahead so that the merge itself cannot fail.
+ */
+bool q_merge_k(queue_t **qs, size_t k)
+{
+    if (qs == NULL || k == 0)
+        return false;
+    for (size_t i = 0; i < k; i++)
+        if (qs[i] == NULL)
+            return false;
+    if (k == 1)
+        return true;
+
+    size_t *tree = malloc(k * sizeof(size_t));
+    merge_src_t *src = malloc(k * sizeof(merge_src_t));
+    qnode_t *pool = NULL; /* Nodes to fill, linked by their next pointers */
+    bool ok = tree != NULL && src != NULL;
+    for (size_t i = 0; ok && i <= k; i++) {
+        qnode_t *n = malloc(sizeof(qnode_t));
+        if (n != NULL) {
+            n->next = pool;
+            pool = n;
+        }
+        ok = n != NULL;
+    }
+    if (!ok) {
+        while (pool != NULL) {
+            qnode_t *n = pool;
+            pool = n->next;
+            free(n);
+        }
+        free(tree);
+        free(src);
+        return false;
+    }
+
+    queue_t *dst = qs[0];
+    for (size_t i = 0; i < k; i++) {
+        src[i].pos = q_iter_begin(qs[i]);
+        merge_load(&src[i]);
+        if (i > 0)
+            dst->size += qs[i]->size;
+        tree[i] = MERGE_FIRST;
+    }
+    for (size_t i = k; i-- > 0;)
+        merge_adjust(tree, src, k, i);
+
+    qnode_t *head = NULL, *tail = NULL;
+    while (src[tree[0]].pos.node != NULL) {
+        size_t w = tree[0];
+        q_iter_t *pos = &src[w].pos;
+        char *value = *slot(pos);
+        qnode_t *n = pos->node;
+        if (++pos->index == n->tail) {
+            pos->node = n->next;
+            pos->index = n->next ? n->next->head : 0;
+            n->next = pool;
+            pool = n;
+        }
+        merge_load(&src[w]);
+        if (tail == NULL || tail->tail == QNODE_CAPACITY) {
+            n = pool;
+            pool = n->next;
+            n->head = n->tail = 0;
+            n->prev = tail;
+            n->next = NULL;
+            if (tail != NULL)
+                tail->next = n;
+            else
+                head = n;
+            tail = n;
+        }
+        tail->value[tail->tail++] = value;
+        merge_adjust(tree, src, k, w);
+    }
+
+    dst->head = head;
+    dst->tail = tail;
+    for (size_t i = 1; i < k; i++) {
+        qs[i]->head = qs[i]->tail = NULL;
+        qs[i]->size = 0;
+    }
+    /* Keep a node left over as the spare of dst, free the others */
+    if (pool != NULL && dst->spare == NULL) {
+        dst->spare = pool;
+        pool = pool->next;
+    }
+    while (pool != NULL) {
+        qnode_t *n = pool;
+        pool = n->next;
+        free(n);
+    }
+    free(tree);
+    free(src);
+    return true;
+}
@@ -0,0 +1,242 @@
+/*
+ * Microbenchmark of the string comparison kernels of strcmp_simd.c against
+ * strcmp and strcasecmp of the C library.  Every kernel the CPU supports is
+ * first checked to order random strings as the library does, including
+ * strings ending right before an unmapped page, then timed on pairs of
+ * strings sharing prefixes of various lengths.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> /* strcasecmp */
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "strcmp_simd.h"
+
+/* Pairs of strings timed, cycled through */
+#define PAIRS 1024
+
+/* Comparisons timed per measurement */
+#define ROUNDS 2000000
+
+/* Measurements per timing */
+#define REPEATS 5
+
+/* Random pairs checked per kernel */
+#define CHECKS 200000
+
+typedef int (*cmp_t)(const char *, const char *);
+
+static int sign(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+/* Letters of both cases and a few bytes around them, including high ones */
+static char random_byte(void)
+{
+    static const char set[] = "aAbBzZ@[`{09_~\x7f\x80\xc1\xff";
+    return set[rand() % (sizeof(set) - 1)];
+}
+
+/*
+ * Fill a and b, each with room for len + 1 bytes, with strings sharing a
+ * prefix of random length, ending after len bytes at most
+ */
+static void random_pair(char *a, char *b, int len)
+{
+    int prefix = rand() % (len + 1);
+    for (int i = 0; i < len; i++) {
+        a[i] = random_byte();
+        b[i] = i < prefix ? a[i] : random_byte();
+    }
+    /* Vary the case of the shared prefix, which only nocase ignores */
+    if (prefix > 0 && rand() % 2) {
+        int i = rand() % prefix;
+        if (a[i] >= 'a' && a[i] <= 'z')
+            b[i] = a[i] - 'a' + 'A';
+    }
+    a[rand() % (len + 1)] = '\0';
+    b[rand() % (len + 1)] = '\0';
+    a[len] = b[len] = '\0';
+}
+
+static bool check_pair(const char *a, const char *b)
+{
+    if (sign(str_cmp(a, b)) != sign(strcmp(a, b)) ||
+        sign(str_casecmp(a, b)) != sign(strcasecmp(a, b))) {
+        printf("  mismatch on \"%s\" and \"%s\"\n", a, b);
+        return false;
+    }
+    return true;
+}
+
+/* End of a page of memory followed by an unmapped one, or NULL */
+static char *guarded_page(void)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    char *map = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    if (mprotect(map + page, page, PROT_NONE) != 0) {
+        munmap(map, 2 * page);
+        return NULL;
+    }
+    return map + page;
+}
+
+static void release_page(char *end)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    munmap(end - page, 2 * page);
+}
+
+/* Check the kernel in use against the C library */
+static bool check_kernel(void)
+{
+    char a[300], b[300];
+    for (int i = 0; i < CHECKS; i++) {
+        random_pair(a, b, rand() % 200);
+        if (!check_pair(a, b) || !check_pair(b, a))
+            return false;
+    }
+
+    /* Strings ending at every offset before a page nothing is mapped at */
+    char *x_end = guarded_page(), *y_end = guarded_page();
+    bool ok = x_end != NULL && y_end != NULL;
+    for (int n = 1; ok && n <= 96; n++) {
+        for (int m = 1; ok && m <= 96; m++) {
+            char *x = x_end - n, *y = y_end - m;
+            random_pair(a, b, 100);
+            memcpy(x, a, n - 1);
+            x[n - 1] = '\0';
+            memcpy(y, b, m - 1);
+            y[m - 1] = '\0';
+            ok = check_pair(x, y) && check_pair(y, x);
+            /* Equal up to the end of the shorter one */
+            memcpy(y, x, (n < m ? n : m) - 1);
+            ok = ok && check_pair(x, y) && check_pair(y, x);
+        }
+    }
+    if (x_end != NULL)
+        release_page(x_end);
+    if (y_end != NULL)
+        release_page(y_end);
+    return ok;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Nanoseconds per call of cmp on the pairs of a and b, the best of REPEATS
+ * measurements, the others having been disturbed
+ */
+static double time_cmp(cmp_t cmp, char **a, char **b)
+{
+    double best = 0;
+    for (int r = 0; r < REPEATS; r++) {
+        volatile int sink = 0;
+        double start = now();
+        for (int i = 0; i < ROUNDS; i++)
+            sink += cmp(a[i % PAIRS], b[i % PAIRS]);
+        (void) sink;
+        double t = (now() - start) * 1e9 / ROUNDS;
+        if (r == 0 || t < best)
+            best = t;
+    }
+    return best;
+}
+
+/*
+ * Comparison as the sorts make it, with the first block compared inline,
+ * though called here like the others
+ */
+static int inline_cmp(const char *a, const char *b)
+{
+    return str_cmp(a, b);
+}
+
+static int inline_casecmp(const char *a, const char *b)
+{
+    return str_casecmp(a, b);
+}
+
+int main(void)
+{
+    static const int prefixes[] = {0, 8, 16, 32, 64, 256};
+    const int nprefixes = sizeof(prefixes) / sizeof(prefixes[0]);
+    int best = str_cmp_best();
+    bool ok = true;
+
+    printf("Fastest kernel: %s\n", str_cmp_name(best));
+    for (int k = STR_CMP_SCALAR; k <= best; k++) {
+        str_cmp_select(k);
+        bool checked = check_kernel();
+        printf("Check of %s: %s\n", str_cmp_name(k),
+               checked ? "ok" : "FAILED");
+        ok = ok && checked;
+    }
+
+    /* Pairs differing in the byte after the prefix, case included */
+    char *a[PAIRS], *b[PAIRS];
+    printf("\nns per comparison, by shared prefix length\n");
+    printf("%-22s", "prefix");
+    for (int p = 0; p < nprefixes; p++)
+        printf("%8d", prefixes[p]);
+    printf("\n");
+    for (int pass = 0; pass < 2; pass++) {
+        bool nocase = pass == 1;
+        /* Times of libc, then of each kernel called and inline */
+        double t[1 + 2 * (STR_CMP_AVX2 + 1)][sizeof(prefixes) /
+                                             sizeof(prefixes[0])];
+        for (int p = 0; p < nprefixes; p++) {
+            int len = prefixes[p];
+            for (int i = 0; i < PAIRS; i++) {
+                a[i] = malloc(len + 2);
+                b[i] = malloc(len + 2);
+                for (int j = 0; j < len; j++)
+                    a[i][j] = b[i][j] = 'a' + rand() % 26;
+                a[i][len] = 'a' + rand() % 26;
+                b[i][len] = a[i][len] + (rand() % 2 ? 1 : 'A' - 'a');
+                a[i][len + 1] = b[i][len + 1] = '\0';
+            }
+            t[0][p] = time_cmp(nocase ? strcasecmp : strcmp, a, b);
+            for (int k = STR_CMP_SCALAR; k <= best; k++) {
+                str_cmp_select(k);
+                t[1 + 2 * k][p] =
+                    time_cmp(nocase ? str_casecmp_fn : str_cmp_fn, a, b);
+                t[2 + 2 * k][p] =
+                    time_cmp(nocase ? inline_casecmp : inline_cmp, a, b);
+            }
+            for (int i = 0; i < PAIRS; i++) {
+                free(a[i]);
+                free(b[i]);
+            }
+        }
+        for (int r = 0; r < 1 + 2 * (best + 1); r++) {
+            /* The scalar kernel is never inlined */
+            if (r == 2 + 2 * STR_CMP_SCALAR)
+                continue;
+            char name[32];
+            snprintf(name, sizeof(name), "%s%s%s",
+                     r == 0 ? "libc" : str_cmp_name((r - 1) / 2),
+                     r > 0 && r % 2 == 0 ? " inline" : "",
+                     nocase ? " nocase" : "");
+            printf("%-22s", name);
+            for (int p = 0; p < nprefixes; p++)
+                printf("%8.2f", t[r][p]);
+            printf("\n");
+        }
+    }
+    return ok ? 0 : 1;
+}
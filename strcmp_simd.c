@@ -0,0 +1,254 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "strcmp_simd.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define STR_CMP_X86 1
+#endif
+
+/*
+ * The bytes past the end of a string never count, but AddressSanitizer
+ * would flag their reads, hence no_sanitize_address on the kernels.
+ */
+
+bool str_cmp_inline = false;
+
+/* Bytes from a and b on before either reaches the end of its page */
+static inline size_t page_room(const unsigned char *a, const unsigned char *b)
+{
+    size_t x = STR_CMP_PAGE - ((uintptr_t) a & (STR_CMP_PAGE - 1));
+    size_t y = STR_CMP_PAGE - ((uintptr_t) b & (STR_CMP_PAGE - 1));
+    return x < y ? x : y;
+}
+
+/*
+ * Compare up to n bytes of a and b one at a time.  Return true and set
+ * *diff if the strings differ or end within them.
+ */
+static inline __attribute__((always_inline)) bool cmp_bytes(
+    const unsigned char *a,
+    const unsigned char *b,
+    int n,
+    bool nocase,
+    int *diff)
+{
+    for (int i = 0; i < n; i++) {
+        int x = nocase ? str_fold(a[i]) : a[i];
+        int y = nocase ? str_fold(b[i]) : b[i];
+        if (x != y || x == 0) {
+            *diff = x - y;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int cmp_scalar(const char *a, const char *b)
+{
+    const unsigned char *x = (const unsigned char *) a;
+    const unsigned char *y = (const unsigned char *) b;
+    while (*x != 0 && *x == *y) {
+        x++;
+        y++;
+    }
+    return *x - *y;
+}
+
+static int casecmp_scalar(const char *a, const char *b)
+{
+    const unsigned char *x = (const unsigned char *) a;
+    const unsigned char *y = (const unsigned char *) b;
+    int c, d;
+    do {
+        c = str_fold(*x++);
+        d = str_fold(*y++);
+    } while (c != 0 && c == d);
+    return c - d;
+}
+
+#ifdef STR_CMP_X86
+
+/*
+ * Compare blocks of 16 bytes until the strings differ or end.  Whole blocks
+ * are loaded as long as both strings have room for them in their pages,
+ * and the block straddling a page end is compared byte by byte.
+ */
+static inline __attribute__((always_inline)) int
+cmp_sse2(const unsigned char *a, const unsigned char *b, bool nocase)
+{
+    int diff;
+    for (;;) {
+        for (size_t room = page_room(a, b); room >= 16;
+             room -= 16, a += 16, b += 16) {
+            unsigned same =
+                str_same_sse2((const char *) a, (const char *) b, nocase);
+            if (same != 0xffff) {
+                int i = __builtin_ctz(~same);
+                return nocase ? str_fold(a[i]) - str_fold(b[i])
+                              : a[i] - b[i];
+            }
+        }
+        if (cmp_bytes(a, b, 16, nocase, &diff))
+            return diff;
+        a += 16;
+        b += 16;
+    }
+}
+
+static __attribute__((no_sanitize_address)) int
+cmp_sse2_kernel(const char *a, const char *b)
+{
+    return cmp_sse2((const unsigned char *) a, (const unsigned char *) b,
+                    false);
+}
+
+static __attribute__((no_sanitize_address)) int
+casecmp_sse2_kernel(const char *a, const char *b)
+{
+    return cmp_sse2((const unsigned char *) a, (const unsigned char *) b,
+                    true);
+}
+
+/* Same as str_fold_sse2, on 32 bytes */
+static inline __attribute__((target("avx2"), always_inline)) __m256i
+fold_avx2(__m256i x)
+{
+    __m256i shifted =
+        _mm256_add_epi8(x, _mm256_set1_epi8((char) (0x80 - 'A')));
+    __m256i upper =
+        _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (0x80 + 26)), shifted);
+    return _mm256_add_epi8(
+        x, _mm256_and_si256(upper, _mm256_set1_epi8('a' - 'A')));
+}
+
+/* Same as cmp_sse2, by blocks of 32 bytes */
+static inline __attribute__((target("avx2"), always_inline)) int
+cmp_avx2(const unsigned char *a, const unsigned char *b, bool nocase)
+{
+    int diff;
+    for (;;) {
+        for (size_t room = page_room(a, b); room >= 32;
+             room -= 32, a += 32, b += 32) {
+            __m256i x = _mm256_loadu_si256((const __m256i *) a);
+            __m256i y = _mm256_loadu_si256((const __m256i *) b);
+            __m256i end = _mm256_cmpeq_epi8(x, _mm256_setzero_si256());
+            unsigned same = _mm256_movemask_epi8(
+                _mm256_andnot_si256(end, _mm256_cmpeq_epi8(x, y)));
+            if (same != 0xffffffff && nocase)
+                same = _mm256_movemask_epi8(_mm256_andnot_si256(
+                    end, _mm256_cmpeq_epi8(fold_avx2(x), fold_avx2(y))));
+            if (same != 0xffffffff) {
+                int i = __builtin_ctz(~same);
+                return nocase ? str_fold(a[i]) - str_fold(b[i])
+                              : a[i] - b[i];
+            }
+        }
+        if (cmp_bytes(a, b, 32, nocase, &diff))
+            return diff;
+        a += 32;
+        b += 32;
+    }
+}
+
+/*
+ * GCC leaves the upper halves of the YMM registers dirty here, the rest of
+ * the program not being compiled for AVX, which would slow down the SSE
+ * code run next.  Hence the explicit VZEROUPPER.
+ */
+static __attribute__((target("avx2"), no_sanitize_address)) int
+cmp_avx2_kernel(const char *a, const char *b)
+{
+    int diff =
+        cmp_avx2((const unsigned char *) a, (const unsigned char *) b, false);
+    _mm256_zeroupper();
+    return diff;
+}
+
+static __attribute__((target("avx2"), no_sanitize_address)) int
+casecmp_avx2_kernel(const char *a, const char *b)
+{
+    int diff =
+        cmp_avx2((const unsigned char *) a, (const unsigned char *) b, true);
+    _mm256_zeroupper();
+    return diff;
+}
+
+#endif /* STR_CMP_X86 */
+
+int str_cmp_best(void)
+{
+#ifdef STR_CMP_X86
+    unsigned eax, ebx, ecx, edx;
+    /* AVX2 needs the OS to save the YMM registers, which XGETBV tells */
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_OSXSAVE) &&
+        (ecx & bit_AVX)) {
+        unsigned xcr0_lo, xcr0_hi;
+        __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        if ((xcr0_lo & 6) == 6 &&
+            __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+            (ebx & bit_AVX2))
+            return STR_CMP_AVX2;
+    }
+    /* Every x86-64 CPU has SSE2 */
+    return STR_CMP_SSE2;
+#else
+    return STR_CMP_SCALAR;
+#endif
+}
+
+int str_cmp_select(int kernel)
+{
+    int best = str_cmp_best();
+    if (kernel < STR_CMP_SCALAR || kernel > best)
+        kernel = best;
+    switch (kernel) {
+#ifdef STR_CMP_X86
+    case STR_CMP_AVX2:
+        str_cmp_fn = cmp_avx2_kernel;
+        str_casecmp_fn = casecmp_avx2_kernel;
+        break;
+    case STR_CMP_SSE2:
+        str_cmp_fn = cmp_sse2_kernel;
+        str_casecmp_fn = casecmp_sse2_kernel;
+        break;
+#endif
+    default:
+        str_cmp_fn = cmp_scalar;
+        str_casecmp_fn = casecmp_scalar;
+        break;
+    }
+    str_cmp_inline = kernel != STR_CMP_SCALAR;
+    return kernel;
+}
+
+const char *str_cmp_name(int kernel)
+{
+    switch (kernel) {
+    case STR_CMP_AVX2:
+        return "avx2";
+    case STR_CMP_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+/* Until a kernel is selected, the first comparison selects the best one */
+static int cmp_first(const char *a, const char *b)
+{
+    str_cmp_select(str_cmp_best());
+    return str_cmp(a, b);
+}
+
+static int casecmp_first(const char *a, const char *b)
+{
+    str_cmp_select(str_cmp_best());
+    return str_casecmp(a, b);
+}
+
+int (*str_cmp_fn)(const char *a, const char *b) = cmp_first;
+int (*str_casecmp_fn)(const char *a, const char *b) = casecmp_first;
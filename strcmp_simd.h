@@ -0,0 +1,153 @@
+#ifndef LAB0_STRCMP_SIMD_H
+#define LAB0_STRCMP_SIMD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * String comparison for sorting.  str_cmp orders strings as strcmp does,
+ * and str_casecmp as strcasecmp does in the C locale, folding ASCII
+ * letters to lower case.  Both compare 32 bytes at a time with AVX2, or
+ * 16 with SSE2, whichever the CPU supports, and byte by byte otherwise.
+ * The kernel is chosen on first use, and the simd option of qtest picks
+ * another.  With a vector kernel, the first 16 bytes are compared inline
+ * and the rest by the kernel, whose choice thus matters for strings that
+ * share 16 bytes or more.
+ *
+ * The vector kernels load whole blocks of both strings, reading past the
+ * end of the shorter one.  Such reads stay within the page holding the
+ * end, so they cannot fault, as long as no block straddles two pages: a
+ * block that would is compared byte by byte instead.
+ */
+
+/* Comparison kernels, from the slowest */
+enum {
+    STR_CMP_SCALAR,
+    STR_CMP_SSE2,
+    STR_CMP_AVX2,
+};
+
+/* Smallest page size, which blocks must not straddle */
+#define STR_CMP_PAGE 4096
+
+extern int (*str_cmp_fn)(const char *a, const char *b);
+extern int (*str_casecmp_fn)(const char *a, const char *b);
+
+/* Whether the first block is compared inline, unless the kernel is scalar */
+extern bool str_cmp_inline;
+
+/*
+ * The helpers of the kernels are always inlined, as GCC would not inline
+ * them into the kernels otherwise under AddressSanitizer, which would then
+ * check their reads past the end of strings.
+ */
+
+/* ASCII lower case of c, as strcasecmp folds it in the C locale */
+static inline __attribute__((always_inline)) int str_fold(unsigned char c)
+{
+    return (unsigned char) (c - 'A') < 26 ? c + ('a' - 'A') : c;
+}
+
+/* Can blocks of width bytes be loaded from a and b? */
+static inline bool str_cmp_loadable(const char *a, const char *b, int width)
+{
+    return ((uintptr_t) a & (STR_CMP_PAGE - 1)) <= STR_CMP_PAGE - width &&
+           ((uintptr_t) b & (STR_CMP_PAGE - 1)) <= STR_CMP_PAGE - width;
+}
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+
+/*
+ * Fold the ASCII letters of x to lower case.  Shifting the bytes by
+ * 0x80 - 'A' makes 'A' to 'Z' the 26 smallest signed bytes, which a
+ * single signed comparison picks.
+ */
+static inline __attribute__((always_inline)) __m128i str_fold_sse2(__m128i x)
+{
+    __m128i shifted = _mm_add_epi8(x, _mm_set1_epi8((char) (0x80 - 'A')));
+    __m128i upper =
+        _mm_cmpgt_epi8(_mm_set1_epi8((char) (0x80 + 26)), shifted);
+    return _mm_add_epi8(x, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+
+/*
+ * Mask of the bytes of the 16 from a and b on that are equal, ignoring case
+ * if nocase, before the end of a
+ */
+static inline __attribute__((always_inline)) unsigned
+str_same_sse2(const char *a, const char *b, bool nocase)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *) a);
+    __m128i y = _mm_loadu_si128((const __m128i *) b);
+    __m128i end = _mm_cmpeq_epi8(x, _mm_setzero_si128());
+    unsigned same =
+        _mm_movemask_epi8(_mm_andnot_si128(end, _mm_cmpeq_epi8(x, y)));
+    /* Bytes differing only in case are rare, fold only for them */
+    if (same != 0xffff && nocase)
+        same = _mm_movemask_epi8(_mm_andnot_si128(
+            end, _mm_cmpeq_epi8(str_fold_sse2(x), str_fold_sse2(y))));
+    return same;
+}
+#endif
+
+/*
+ * Most strings compared differ or end within their first 16 bytes, which
+ * SSE2, part of every x86-64 CPU, settles inline rather than through a
+ * call.  Not under AddressSanitizer though, which would flag the bytes
+ * read past the end; the kernels are exempt from it.
+ */
+#if defined(__x86_64__) && !defined(__SANITIZE_ADDRESS__)
+
+static inline int str_cmp_head(const char *a,
+                               const char *b,
+                               bool nocase,
+                               int (*rest)(const char *, const char *))
+{
+    if (!str_cmp_inline || !str_cmp_loadable(a, b, 16))
+        return rest(a, b);
+    unsigned same = str_same_sse2(a, b, nocase);
+    if (same == 0xffff)
+        return rest(a + 16, b + 16);
+    int i = __builtin_ctz(~same);
+    unsigned char x = a[i], y = b[i];
+    return nocase ? str_fold(x) - str_fold(y) : x - y;
+}
+
+static inline int str_cmp(const char *a, const char *b)
+{
+    return str_cmp_head(a, b, false, str_cmp_fn);
+}
+
+static inline int str_casecmp(const char *a, const char *b)
+{
+    return str_cmp_head(a, b, true, str_casecmp_fn);
+}
+
+#else
+
+static inline int str_cmp(const char *a, const char *b)
+{
+    return str_cmp_fn(a, b);
+}
+
+static inline int str_casecmp(const char *a, const char *b)
+{
+    return str_casecmp_fn(a, b);
+}
+
+#endif
+
+/* Fastest kernel the CPU supports, as cpuid tells */
+int str_cmp_best(void);
+
+/*
+ * Use kernel from now on, or the fastest one supported should the CPU not
+ * support it.  Return the kernel in use.
+ */
+int str_cmp_select(int kernel);
+
+/* Name of kernel */
+const char *str_cmp_name(int kernel);
+
+#endif
@@ -0,0 +1,22 @@
+# Test of remove_tail mixed with insert, reverse and sort
+option fail 0
+option malloc 0
+new
+ih gerbil
+ih bear
+ih dolphin
+it meerkat
+it bear
+it gerbil
+rt gerbil
+rt bear
+reverse
+it squirrel
+ih vulture
+sort
+it meerkat
+rtq
+rt vulture
+rh bear
+size
+free
@@ -0,0 +1,21 @@
+# Test performance of remove_head and remove_tail on both ends of the queue
+option fail 0
+option malloc 0
+new
+ih dolphin 1000000
+it gerbil 1000000
+rtq 500000
+rhq 500000
+ih jaguar 1000
+it meerkat 1000
+rt meerkat
+rh jaguar
+reverse
+rtq 999
+rhq 999
+rt dolphin
+rh gerbil
+rtq 499999
+rhn 499999
+size
+free
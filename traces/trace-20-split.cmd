@@ -0,0 +1,54 @@
+# Test of splice and split across several queues
+option fail 0
+option malloc 0
+new
+ih dolphin
+ih bear
+ih gerbil
+it meerkat
+it squirrel
+split 2 1
+size
+rh gerbil
+rh bear
+switch 1
+size
+rh dolphin
+switch 2
+new
+it vulture
+it bear
+switch 1
+splice 2
+splice 0
+it gerbil
+rt gerbil
+rt bear
+rh meerkat
+split 0 3
+size
+switch 3
+rh squirrel
+rh vulture
+free
+switch 2
+ih zebra
+free
+switch 1
+free
+switch 0
+free
+new
+ih RAND 500000
+split 250000 1
+split 100000 2
+splice 2
+splice 1
+size
+switch 1
+free
+switch 2
+free
+switch 0
+rhq 500000
+free
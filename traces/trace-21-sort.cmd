@@ -0,0 +1,41 @@
+# Test of sort on mixed case, digits and punctuation, by bytes and ignoring case
+option fail 0
+option malloc 0
+new
+ih apple
+ih Banana
+ih banana
+ih _under
+ih 42
+ih Apple
+ih apricot
+ih APRICOT9
+ih ~tilde
+ih zebra
+it commonprefixcommonprefixcommonprefixcommonprefixa
+it CommonPrefixCommonPrefixCommonPrefixCommonPrefixB
+sort
+rh 42
+rh APRICOT9
+rh Apple
+rh Banana
+rh CommonPrefixCommonPrefixCommonPrefixCommonPrefixB
+option nocase 1
+reverse
+sort
+rh _under
+rh apple
+rh apricot
+rh banana
+rh commonprefixcommonprefixcommonprefixcommonprefixa
+rh zebra
+rh ~tilde
+ih RAND 100000
+it CommonPrefixCommonPrefixZ 1000
+it commonprefixcommonprefixy 1000
+sort
+reverse
+sort
+option nocase 0
+sort
+free
@@ -0,0 +1,30 @@
+# Test of the natural merge sort on random, sorted, reversed and nearly sorted queues
+option fail 0
+option malloc 0
+option sort 1
+new
+ih RAND 100000
+sort
+sort
+reverse
+sort
+it gerbil 50000
+ih dolphin 50000
+it a
+ih zzzzzzzzzz
+sort
+reverse
+rh zzzzzzzzzz
+rt a
+sort
+free
+new
+ih bear
+ih dolphin
+ih bear
+ih aardvark
+it RAND 5
+sort
+reverse
+sort
+free
@@ -0,0 +1,22 @@
+# Test of sort with several threads, by both sort algorithms
+option fail 0
+option malloc 0
+option sort_threads 4
+new
+ih RAND 200000
+it Zebra 20000
+ih ~tilde 20000
+sort
+rh Zebra
+rt ~tilde
+reverse
+sort
+option nocase 1
+sort
+option sort 1
+reverse
+sort
+option nocase 0
+sort
+size
+free
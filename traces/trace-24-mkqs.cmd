@@ -0,0 +1,40 @@
+# Test of the multikey quicksort on duplicates, shared prefixes and with several threads
+option fail 0
+option malloc 0
+option sort 2
+new
+ih dolphin 50000
+it dolphins 1000
+ih RAND 50000
+it a
+ih zzzzzzzzzz
+sort
+rh a
+rt zzzzzzzzzz
+reverse
+sort
+ih CommonPrefixCommonPrefixB 1000
+it CommonPrefixCommonPrefixA 1000
+it CommonPrefixCommonPrefix 1000
+sort
+option sort_threads 4
+it RAND 100000
+sort
+option nocase 1
+it DOLPHIN 1000
+sort
+option nocase 0
+sort
+option sort_threads 1
+size
+free
+new
+ih bear
+ih dolphin
+ih bear
+ih aardvark
+it RAND 5
+sort
+reverse
+sort
+free
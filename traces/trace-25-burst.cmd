@@ -0,0 +1,40 @@
+# Test of burstsort on random strings, duplicates, shared prefixes and with several threads
+option fail 0
+option malloc 0
+option sort 3
+new
+ih RAND 100000
+it a
+ih zzzzzzzzzz
+sort
+rh a
+rt zzzzzzzzzz
+ih dolphin 20000
+it dolphins 2000
+ih CommonPrefixCommonPrefixB 5000
+it CommonPrefixCommonPrefixA 5000
+it CommonPrefixCommonPrefix 5000
+sort
+reverse
+sort
+option sort_threads 4
+it RAND 50000
+sort
+option nocase 1
+it DOLPHIN 3000
+sort
+option nocase 0
+sort
+option sort_threads 1
+size
+free
+new
+ih bear
+ih dolphin
+ih bear
+ih aardvark
+it RAND 5
+sort
+reverse
+sort
+free
@@ -0,0 +1,39 @@
+# Test of external sort under small memory budgets, forcing many runs and merge passes
+option fail 0
+option malloc 0
+option budget 8192
+new
+ih RAND 10000
+it a
+ih zzzzzzzzzz
+esort
+rh a
+rt zzzzzzzzzz
+ih dolphin 2000
+it gerbil 2000
+reverse
+esort
+option budget 65536
+option nocase 1
+it DOLPHIN 500
+ih Gerbil 500
+esort
+option nocase 0
+esort
+size
+free
+new
+esort
+ih bear
+esort
+ih dolphin
+ih bear
+ih aardvark
+option budget 1048576
+esort
+rh aardvark
+rh bear
+rh bear
+it RAND 5
+esort
+free
@@ -0,0 +1,36 @@
+# Test of partial sort, the k smallest strings at head in ascending order
+option fail 0
+option malloc 0
+new
+ih dolphin 20000
+ih RAND 100000
+it 0aardvark
+ih gerbil 20000
+it 1bear
+psort 2
+rh 0aardvark
+rh 1bear
+psort 1000
+psort 1
+rhq 500
+psort 0
+it RAND 10000
+option nocase 1
+it 0Aardvark
+psort 10
+rh 0Aardvark
+option nocase 0
+psort 200000
+size
+free
+new
+ih bear
+ih dolphin
+ih bear
+ih aardvark
+it RAND 5
+psort 3
+reverse
+psort 9
+psort 1
+free
@@ -0,0 +1,423 @@
+# Test of merging sorted queues, 64 of them with 100000 elements each
+option fail 0
+option malloc 0
+new
+it bear
+it gerbil
+it vulture
+switch 1
+new
+it aardvark
+it dolphin
+it gerbil
+it zebra
+switch 2
+new
+switch 3
+new
+it meerkat
+switch 0
+merge 2 1 3
+size
+rh aardvark
+rh bear
+rh dolphin
+rh gerbil
+rh gerbil
+rh meerkat
+rh vulture
+rh zebra
+switch 1
+free
+switch 2
+free
+switch 3
+free
+switch 0
+free
+switch 1
+new
+ih RAND 100000
+sort
+switch 2
+new
+ih RAND 100000
+sort
+switch 3
+new
+ih RAND 100000
+sort
+switch 4
+new
+ih RAND 100000
+sort
+switch 5
+new
+ih RAND 100000
+sort
+switch 6
+new
+ih RAND 100000
+sort
+switch 7
+new
+ih RAND 100000
+sort
+switch 8
+new
+ih RAND 100000
+sort
+switch 9
+new
+ih RAND 100000
+sort
+switch 10
+new
+ih RAND 100000
+sort
+switch 11
+new
+ih RAND 100000
+sort
+switch 12
+new
+ih RAND 100000
+sort
+switch 13
+new
+ih RAND 100000
+sort
+switch 14
+new
+ih RAND 100000
+sort
+switch 15
+new
+ih RAND 100000
+sort
+switch 16
+new
+ih RAND 100000
+sort
+switch 17
+new
+ih RAND 100000
+sort
+switch 18
+new
+ih RAND 100000
+sort
+switch 19
+new
+ih RAND 100000
+sort
+switch 20
+new
+ih RAND 100000
+sort
+switch 21
+new
+ih RAND 100000
+sort
+switch 22
+new
+ih RAND 100000
+sort
+switch 23
+new
+ih RAND 100000
+sort
+switch 24
+new
+ih RAND 100000
+sort
+switch 25
+new
+ih RAND 100000
+sort
+switch 26
+new
+ih RAND 100000
+sort
+switch 27
+new
+ih RAND 100000
+sort
+switch 28
+new
+ih RAND 100000
+sort
+switch 29
+new
+ih RAND 100000
+sort
+switch 30
+new
+ih RAND 100000
+sort
+switch 31
+new
+ih RAND 100000
+sort
+switch 32
+new
+ih RAND 100000
+sort
+switch 33
+new
+ih RAND 100000
+sort
+switch 34
+new
+ih RAND 100000
+sort
+switch 35
+new
+ih RAND 100000
+sort
+switch 36
+new
+ih RAND 100000
+sort
+switch 37
+new
+ih RAND 100000
+sort
+switch 38
+new
+ih RAND 100000
+sort
+switch 39
+new
+ih RAND 100000
+sort
+switch 40
+new
+ih RAND 100000
+sort
+switch 41
+new
+ih RAND 100000
+sort
+switch 42
+new
+ih RAND 100000
+sort
+switch 43
+new
+ih RAND 100000
+sort
+switch 44
+new
+ih RAND 100000
+sort
+switch 45
+new
+ih RAND 100000
+sort
+switch 46
+new
+ih RAND 100000
+sort
+switch 47
+new
+ih RAND 100000
+sort
+switch 48
+new
+ih RAND 100000
+sort
+switch 49
+new
+ih RAND 100000
+sort
+switch 50
+new
+ih RAND 100000
+sort
+switch 51
+new
+ih RAND 100000
+sort
+switch 52
+new
+ih RAND 100000
+sort
+switch 53
+new
+ih RAND 100000
+sort
+switch 54
+new
+ih RAND 100000
+sort
+switch 55
+new
+ih RAND 100000
+sort
+switch 56
+new
+ih RAND 100000
+sort
+switch 57
+new
+ih RAND 100000
+sort
+switch 58
+new
+ih RAND 100000
+sort
+switch 59
+new
+ih RAND 100000
+sort
+switch 60
+new
+ih RAND 100000
+sort
+switch 61
+new
+ih RAND 100000
+sort
+switch 62
+new
+ih RAND 100000
+sort
+switch 63
+new
+ih RAND 100000
+sort
+switch 0
+new
+ih RAND 100000
+sort
+merge 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31 32 33 34 35 36 37 38 39 40 41 42 43 44 45 46 47 48 49 50 51 52 53 54 55 56 57 58 59 60 61 62 63
+size
+switch 1
+free
+switch 2
+free
+switch 3
+free
+switch 4
+free
+switch 5
+free
+switch 6
+free
+switch 7
+free
+switch 8
+free
+switch 9
+free
+switch 10
+free
+switch 11
+free
+switch 12
+free
+switch 13
+free
+switch 14
+free
+switch 15
+free
+switch 16
+free
+switch 17
+free
+switch 18
+free
+switch 19
+free
+switch 20
+free
+switch 21
+free
+switch 22
+free
+switch 23
+free
+switch 24
+free
+switch 25
+free
+switch 26
+free
+switch 27
+free
+switch 28
+free
+switch 29
+free
+switch 30
+free
+switch 31
+free
+switch 32
+free
+switch 33
+free
+switch 34
+free
+switch 35
+free
+switch 36
+free
+switch 37
+free
+switch 38
+free
+switch 39
+free
+switch 40
+free
+switch 41
+free
+switch 42
+free
+switch 43
+free
+switch 44
+free
+switch 45
+free
+switch 46
+free
+switch 47
+free
+switch 48
+free
+switch 49
+free
+switch 50
+free
+switch 51
+free
+switch 52
+free
+switch 53
+free
+switch 54
+free
+switch 55
+free
+switch 56
+free
+switch 57
+free
+switch 58
+free
+switch 59
+free
+switch 60
+free
+switch 61
+free
+switch 62
+free
+switch 63
+free
+switch 0
+free
@@ -0,0 +1,42 @@
+# Test of sort and dedup on many copies of a few strings
+option fail 0
+option malloc 0
+new
+ih dolphin 1000000
+it gerbil 1000000
+reverse
+it dolphin 1000
+sort
+dedup
+size
+rh dolphin
+rh gerbil
+ih aardvark 2
+it bear 3
+it aardvark
+it bear
+it zebra 50
+dedup
+rh aardvark
+rh bear
+rh aardvark
+rh bear
+rh zebra
+size
+ih bear 1000
+it Bear 1000
+it BEAR 1000
+option nocase 1
+sort
+dedup
+size
+option nocase 0
+free
+new
+ih gerbil 100000
+ih RAND 100000
+it gerbil 100000
+sort
+dedup
+size
+free
@@ -0,0 +1,48 @@
+# Test of sort in descending order and ignoring case
+option fail 0
+option malloc 0
+new
+it gerbil
+it Bear
+it dolphin
+it aardvark
+it Zebra
+it bear
+sort desc
+rh gerbil
+rh dolphin
+rh bear
+rh aardvark
+rh Zebra
+rh Bear
+it gerbil
+it Bear
+it dolphin
+it aardvark
+it Zebra
+sort nocase
+rh aardvark
+rh Bear
+rh dolphin
+rh gerbil
+rh Zebra
+it gerbil
+it Bear
+it dolphin
+it aardvark
+it Zebra
+sort desc nocase
+rh Zebra
+rh gerbil
+rh dolphin
+rh Bear
+rh aardvark
+ih RAND 200000
+it dolphin 100000
+sort desc
+ih gerbil 1000
+sort
+sort desc nocase
+reverse
+sort desc
+free
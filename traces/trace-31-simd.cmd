@@ -0,0 +1,108 @@
+# Test of sort with every string comparison kernel
+option fail 0
+option malloc 0
+option simd 0
+new
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cattle
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat_
+sort
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat_
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cattle
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Dog
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+sort nocase
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Dog
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_dog
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Bat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+sort desc nocase
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_dog
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Bat
+ih RAND 100000
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_x 1000
+sort
+sort desc nocase
+dedup
+free
+option simd 1
+new
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cattle
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat_
+sort
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat_
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cattle
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Dog
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+sort nocase
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Dog
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_dog
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Bat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+sort desc nocase
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_dog
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Bat
+ih RAND 100000
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_x 1000
+sort
+sort desc nocase
+dedup
+free
+option simd 2
+new
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cattle
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat_
+sort
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat_
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cattle
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Dog
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+sort nocase
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_bat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Dog
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_dog
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Bat
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+sort desc nocase
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_dog
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_cat
+rh thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_Bat
+ih RAND 100000
+it thequickbrownfoxjumpsoverthelazydog_thequickbrownfox_x 1000
+sort
+sort desc nocase
+dedup
+free
@@ -0,0 +1,33 @@
+# Test of fast harness mode, checking one block in 64
+option fail 0
+option malloc 0
+option fast 64
+new
+ih dolphin 1000000
+it gerbil 1000000
+size 1000
+reverse
+sort
+# Blocks allocated in fast mode get freed with all checks on, and conversely
+option fast 0
+ih aardvark
+it zebra
+option fast 64
+rh aardvark
+rt zebra
+free
+new
+ih RAND 100000
+option fast 16
+it RAND 100000
+sort
+option fast 0
+free
+# Malloc failures in fast mode
+option fail 30
+option fast 4
+new
+option malloc 50
+ih gerbil 20
+it lion 20
+free
@@ -0,0 +1,27 @@
+# Test of heap profiling by call site
+option fail 0
+option malloc 0
+option profile 1
+new
+ih RAND 1000
+it dolphin 500
+heapprof
+switch 1
+new
+ih gerbil 100
+option fast 8
+it lion 100
+switch 0
+option fast 0
+free
+heapprof
+option profile 0
+new
+ih aardvark 10
+heapprof
+free
+switch 1
+rh gerbil
+rt lion
+free
+heapprof
@@ -0,0 +1,51 @@
+# Test of guarded mode, placing blocks against guard pages
+option fail 0
+option malloc 0
+option guard 1
+new
+ih dolphin
+ih bear
+it gerbil
+it RAND 200
+sort
+reverse
+dedup
+rh
+rt
+rhq
+rhn 10
+# Removed strings are copied into buffers ending against a guard page too
+option length 8
+it hippopotamus
+rt hippopot
+option length 1024
+show
+# Blocks allocated guarded get freed unguarded, and conversely
+option guard 0
+ih aardvark
+it zebra
+option guard 1
+rh aardvark
+rt zebra
+free
+# Guarding one block in 64, along with fast mode and profiling
+option guard 64
+option fast 16
+option profile 1
+new
+ih RAND 50000
+it meerkat 20000
+sort
+size 1000
+heapprof
+free
+option profile 0
+option fast 0
+# Malloc failures of guarded blocks
+option fail 30
+option guard 2
+new
+option malloc 50
+ih gerbil 20
+it lion 20
+free
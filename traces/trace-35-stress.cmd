@@ -0,0 +1,22 @@
+# Test of the harness under threads freeing the blocks of one another
+option fail 0
+option malloc 0
+new
+ih dolphin 10
+stress
+stress 16 20000
+option fast 8
+stress 8 20000
+option fast 0
+option guard 16
+stress 4 5000
+option guard 0
+option profile 1
+stress 4 5000
+heapprof
+option profile 0
+option malloc 10
+stress 4 2000
+option malloc 0
+rh dolphin
+free
@@ -0,0 +1,18 @@
+# Test of external sort spilling more runs than files may be open at once
+option fail 0
+option malloc 0
+option budget 8192
+new
+ih RAND 100000
+it a
+ih zzzzzzzzzz
+esort
+rh a
+rt zzzzzzzzzz
+option nocase 1
+ih DOLPHIN 1000
+it Gerbil 1000
+esort
+option nocase 0
+size
+free
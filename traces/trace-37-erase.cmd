@@ -0,0 +1,51 @@
+# Test of erase by handles kept across insert, remove_tail, reverse and sort,
+# and of erase by the handle of an element removed since
+option fail 0
+option malloc 0
+new
+ih gerbil
+ih bear
+ih dolphin
+it meerkat
+it bear
+it gerbil
+mark 0 1
+mark 1 3
+mark 2 0
+ih vulture
+it aardvark
+rt aardvark
+rt gerbil
+erase 0 bear
+reverse
+it squirrel
+mark 3 5
+ih zebra
+erase 1 meerkat
+sort
+erase 3 squirrel
+erase 2 dolphin
+mark 4 3
+mark 5 0
+erase 4 zebra
+erase 5 bear
+it meerkat
+rtq
+rt vulture
+rh gerbil
+ih lion
+it mouse
+mark 6 0
+mark 7 1
+rh lion
+ih tiger
+rt mouse
+it horse
+option fail 10
+erase 6
+erase 7
+option fail 0
+rh tiger
+rt horse
+size
+free
@@ -0,0 +1,101 @@
+# Test of merging sorted queues, 16 of them with 20000 elements each
+option fail 0
+option malloc 0
+switch 1
+new
+ih RAND 20000
+sort
+switch 2
+new
+ih RAND 20000
+sort
+switch 3
+new
+ih RAND 20000
+sort
+switch 4
+new
+ih RAND 20000
+sort
+switch 5
+new
+ih RAND 20000
+sort
+switch 6
+new
+ih RAND 20000
+sort
+switch 7
+new
+ih RAND 20000
+sort
+switch 8
+new
+ih RAND 20000
+sort
+switch 9
+new
+ih RAND 20000
+sort
+switch 10
+new
+ih RAND 20000
+sort
+switch 11
+new
+ih RAND 20000
+sort
+switch 12
+new
+ih RAND 20000
+sort
+switch 13
+new
+ih RAND 20000
+sort
+switch 14
+new
+ih RAND 20000
+sort
+switch 15
+new
+ih RAND 20000
+sort
+switch 0
+new
+ih RAND 20000
+sort
+merge 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15
+size
+switch 1
+free
+switch 2
+free
+switch 3
+free
+switch 4
+free
+switch 5
+free
+switch 6
+free
+switch 7
+free
+switch 8
+free
+switch 9
+free
+switch 10
+free
+switch 11
+free
+switch 12
+free
+switch 13
+free
+switch 14
+free
+switch 15
+free
+switch 0
+free